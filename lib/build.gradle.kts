@@ -25,6 +25,18 @@ android {
     }
 
     buildTypes {
+        debug {
+            // Counting replaces the global operator new and delete of the whole process, so it is
+            // only built in on request, e.g. for the instrumented tests:
+            // ./gradlew connectedDebugAndroidTest -PfaceDetectionCountAllocations=true
+            if (providers.gradleProperty("faceDetectionCountAllocations").orNull.toBoolean()) {
+                externalNativeBuild {
+                    cmake {
+                        arguments += "-DFACE_DETECTION_COUNT_ALLOCATIONS=ON"
+                    }
+                }
+            }
+        }
         release {
             isMinifyEnabled = false
             proguardFiles(
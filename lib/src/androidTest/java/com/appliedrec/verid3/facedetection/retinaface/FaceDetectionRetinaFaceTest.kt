@@ -5,10 +5,12 @@ import android.graphics.Bitmap
 import android.graphics.BitmapFactory
 import android.graphics.Canvas
 import android.graphics.Color
+import android.graphics.Matrix
 import android.graphics.Paint
 import android.graphics.PointF
 import android.graphics.PorterDuff
 import android.graphics.PorterDuffXfermode
+import android.graphics.Rect
 import android.graphics.RectF
 import android.util.Log
 import androidx.test.ext.junit.runners.AndroidJUnit4
@@ -21,10 +23,13 @@ import com.appliedrec.verid3.common.use
 import kotlinx.coroutines.runBlocking
 import org.json.JSONObject
 import org.junit.Assert
+import org.junit.Assume
 import org.junit.Ignore
 import org.junit.Test
 import org.junit.runner.RunWith
+import java.nio.ByteBuffer
 import kotlin.math.hypot
+import kotlin.math.roundToInt
 import kotlin.system.measureTimeMillis
 
 /**
@@ -51,6 +56,406 @@ class FaceDetectionRetinaFaceTest {
         return@runBlocking
     }
 
+    @Test
+    fun testDetectFaceWithByteInput() = runBlocking {
+        val bitmap = InstrumentationRegistry.getInstrumentation()
+            .context.assets.open("image.jpg").use(BitmapFactory::decodeStream)
+        val image = Image.fromBitmap(bitmap)
+        val faces = FaceDetectionRetinaFace.create(
+            InstrumentationRegistry.getInstrumentation().targetContext,
+            inputFormat = InputFormat.UINT8_NHWC
+        ).use { faceDetection ->
+            Assert.assertEquals(InputFormat.UINT8_NHWC, faceDetection.modelInputFormat)
+            faceDetection.detectFacesInImage(image, 1)
+        }
+        Assert.assertEquals(1, faces.size)
+        val expectedFace = loadExpectedFace()
+        Assert.assertTrue(compareFaces(faces[0], expectedFace, image.width.toFloat() * 0.1f))
+        return@runBlocking
+    }
+
+    @Test
+    fun testDetectFaceWithHalfPrecisionModel() = runBlocking {
+        val bitmap = InstrumentationRegistry.getInstrumentation()
+            .context.assets.open("image.jpg").use(BitmapFactory::decodeStream)
+        val image = Image.fromBitmap(bitmap)
+        val faces = FaceDetectionRetinaFace(
+            InstrumentationRegistry.getInstrumentation().targetContext,
+            SessionConfiguration.FP16
+        ).use { faceDetection ->
+            Assert.assertEquals(InputFormat.FLOAT16_NCHW, faceDetection.modelInputFormat)
+            faceDetection.detectFacesInImage(image, 1)
+        }
+        Assert.assertEquals(1, faces.size)
+        val expectedFace = loadExpectedFace()
+        Assert.assertTrue(compareFaces(faces[0], expectedFace, image.width.toFloat() * 0.1f))
+        return@runBlocking
+    }
+
+    @Test
+    fun testDetectFaceWithQuantizedModel() = runBlocking {
+        val bitmap = InstrumentationRegistry.getInstrumentation()
+            .context.assets.open("image.jpg").use(BitmapFactory::decodeStream)
+        val image = Image.fromBitmap(bitmap)
+        val faces = FaceDetectionRetinaFace(
+            InstrumentationRegistry.getInstrumentation().targetContext,
+            SessionConfiguration.INT8
+        ).use { faceDetection ->
+            Assert.assertEquals(InputFormat.QUANTIZED_NCHW, faceDetection.modelInputFormat)
+            faceDetection.detectFacesInImage(image, 1)
+        }
+        Assert.assertEquals(1, faces.size)
+        val expectedFace = loadExpectedFace()
+        Assert.assertTrue(compareFaces(faces[0], expectedFace, image.width.toFloat() * 0.1f))
+        return@runBlocking
+    }
+
+    @Test
+    fun testDetectFaceWithEachSuppressionMode() = runBlocking {
+        val bitmap = InstrumentationRegistry.getInstrumentation()
+            .context.assets.open("image.jpg").use(BitmapFactory::decodeStream)
+        val image = Image.fromBitmap(bitmap)
+        val expectedFace = loadExpectedFace()
+        FaceDetectionRetinaFace.create(
+            InstrumentationRegistry.getInstrumentation().targetContext
+        ).use { faceDetection ->
+            for (mode in SuppressionMode.entries) {
+                faceDetection.suppression = SuppressionOptions(mode)
+                val faces = faceDetection.detectFacesInImage(image, 1)
+                Assert.assertEquals(1, faces.size)
+                Assert.assertTrue("$mode", compareFaces(faces[0], expectedFace, image.width.toFloat() * 0.1f))
+            }
+        }
+        return@runBlocking
+    }
+
+    @Test
+    fun testRejectFacesInNativeFilter() = runBlocking {
+        val bitmap = InstrumentationRegistry.getInstrumentation()
+            .context.assets.open("image.jpg").use(BitmapFactory::decodeStream)
+        val image = Image.fromBitmap(bitmap)
+        val expectedFace = loadExpectedFace()
+        val faceSize = maxOf(expectedFace.bounds.width(), expectedFace.bounds.height())
+        FaceDetectionRetinaFace.create(
+            InstrumentationRegistry.getInstrumentation().targetContext
+        ).use { faceDetection ->
+            faceDetection.minFaceSize = faceSize * 0.5f
+            faceDetection.maxFaceSize = faceSize * 2f
+            Assert.assertEquals(1, faceDetection.detectFacesInImage(image, 1).size)
+            faceDetection.minFaceSize = faceSize * 1.5f
+            Assert.assertTrue(faceDetection.detectFacesInImage(image, 1).isEmpty())
+            faceDetection.minFaceSize = 0f
+            faceDetection.maxFaceSize = faceSize * 0.5f
+            Assert.assertTrue(faceDetection.detectFacesInImage(image, 1).isEmpty())
+            faceDetection.maxFaceSize = Float.POSITIVE_INFINITY
+            faceDetection.confidenceThreshold = 1f
+            Assert.assertTrue(faceDetection.detectFacesInImage(image, 1).isEmpty())
+        }
+        return@runBlocking
+    }
+
+    @Test
+    fun testDetectorsShareThreadPool() = runBlocking {
+        val bitmap = InstrumentationRegistry.getInstrumentation()
+            .context.assets.open("image.jpg").use(BitmapFactory::decodeStream)
+        val image = Image.fromBitmap(bitmap)
+        val expectedFace = loadExpectedFace()
+        val context = InstrumentationRegistry.getInstrumentation().targetContext
+        FaceDetectionRetinaFace.threadPoolOptions = ThreadPoolOptions(threads = 2, allowSpinning = false)
+        try {
+            val detectors = listOf(SessionConfiguration.FP32, SessionConfiguration.FP16, SessionConfiguration.INT8)
+                .map { FaceDetectionRetinaFace(context, it) }
+            try {
+                Assert.assertEquals(1, detectors.map { it.environmentHandle }.distinct().size)
+                Assert.assertEquals(2, FaceDetectionRetinaFace.environmentThreads())
+                Assert.assertTrue(FaceDetectionRetinaFace.environmentHasGlobalThreadPools())
+                for (faceDetection in detectors) {
+                    val faces = faceDetection.detectFacesInImage(image, 1)
+                    Assert.assertEquals(1, faces.size)
+                    Assert.assertTrue(compareFaces(faces[0], expectedFace, image.width.toFloat() * 0.1f))
+                }
+            } finally {
+                detectors.forEach { it.close() }
+            }
+        } finally {
+            FaceDetectionRetinaFace.threadPoolOptions = ThreadPoolOptions()
+        }
+        return@runBlocking
+    }
+
+    @Test
+    fun testDetectFacesInBatch() = runBlocking {
+        val bitmap = InstrumentationRegistry.getInstrumentation()
+            .context.assets.open("image.jpg").use(BitmapFactory::decodeStream)
+        val image = Image.fromBitmap(bitmap)
+        val expectedFace = loadExpectedFace()
+        val context = InstrumentationRegistry.getInstrumentation().targetContext
+        for (configuration in listOf(SessionConfiguration.FP32, SessionConfiguration.FP16, SessionConfiguration.INT8)) {
+            FaceDetectionRetinaFace(context, configuration).use { faceDetection ->
+                val batch = faceDetection.detectFacesInImages(List(3) { image }, 1)
+                Assert.assertEquals(3, batch.size)
+                val single = faceDetection.detectFacesInImage(image, 1)
+                for (faces in batch) {
+                    Assert.assertEquals(1, faces.size)
+                    Assert.assertTrue(compareFaces(faces[0], expectedFace, image.width.toFloat() * 0.1f))
+                    Assert.assertTrue(compareFaces(faces[0], single[0], image.width.toFloat() * 0.01f))
+                }
+            }
+        }
+        return@runBlocking
+    }
+
+    @Test
+    fun testDetectFaceInRegion() = runBlocking {
+        val bitmap = InstrumentationRegistry.getInstrumentation()
+            .context.assets.open("image.jpg").use(BitmapFactory::decodeStream)
+        val image = Image.fromBitmap(bitmap)
+        val expectedFace = loadExpectedFace()
+        val region = Rect()
+        RectF(expectedFace.bounds).apply {
+            inset(-width() * 0.5f, -height() * 0.5f)
+            intersect(0f, 0f, image.width.toFloat(), image.height.toFloat())
+        }.roundOut(region)
+        val faces = FaceDetectionRetinaFace.create(
+            InstrumentationRegistry.getInstrumentation().targetContext
+        ).use { faceDetection ->
+            faceDetection.detectFacesInImage(image, 1, region)
+        }
+        Assert.assertEquals(1, faces.size)
+        Assert.assertTrue(compareFaces(faces[0], expectedFace, image.width.toFloat() * 0.1f))
+        return@runBlocking
+    }
+
+    @Test
+    fun testDetectFaceWithInputMatchingAspectRatio() = runBlocking {
+        val bitmap = InstrumentationRegistry.getInstrumentation()
+            .context.assets.open("image.jpg").use(BitmapFactory::decodeStream)
+        val image = Image.fromBitmap(bitmap)
+        val faces = FaceDetectionRetinaFace.create(
+            InstrumentationRegistry.getInstrumentation().targetContext
+        ).use { faceDetection ->
+            faceDetection.detectFacesInImage(image, 1, Rect(0, 0, image.width, image.height),
+                inputSize = InputSize.MATCH_ASPECT_RATIO)
+        }
+        Assert.assertEquals(1, faces.size)
+        val expectedFace = loadExpectedFace()
+        Assert.assertTrue(compareFaces(faces[0], expectedFace, image.width.toFloat() * 0.1f))
+        return@runBlocking
+    }
+
+    @Test
+    fun testNonSquarePriorTablesMatchReference() = runBlocking {
+        // The bundled models have a fixed square input, so non-square sizes are checked natively
+        FaceDetectionRetinaFace(
+            InstrumentationRegistry.getInstrumentation().targetContext,
+            SessionConfiguration.FP32
+        ).use { faceDetection ->
+            Assert.assertTrue(faceDetection.verifyPriorTables())
+        }
+        return@runBlocking
+    }
+
+    @Test
+    fun testDetectFaceInTiles() = runBlocking {
+        val bitmap = InstrumentationRegistry.getInstrumentation()
+            .context.assets.open("image.jpg").use(BitmapFactory::decodeStream)
+        // Place the photo in a large canvas so the face only covers a small part of it
+        val large = Bitmap.createBitmap(bitmap.width * 4, bitmap.height * 4, Bitmap.Config.ARGB_8888)
+        Canvas(large).apply {
+            drawColor(Color.WHITE)
+            drawBitmap(bitmap, bitmap.width.toFloat(), bitmap.height.toFloat(), null)
+        }
+        val image = Image.fromBitmap(large)
+        val faces = FaceDetectionRetinaFace.create(
+            InstrumentationRegistry.getInstrumentation().targetContext
+        ).use { faceDetection ->
+            faceDetection.detectFacesInTiles(image, 1, TilingOptions(scales = 3, maxTiles = 32))
+        }
+        Assert.assertEquals(1, faces.size)
+        val expectedLandmarks = loadExpectedFace().landmarks.map { PointF(it.x + bitmap.width, it.y + bitmap.height) }
+        val maxDistance = faces[0].landmarks.zip(expectedLandmarks).maxOf { (p1, p2) -> p1.distanceTo(p2) }
+        Assert.assertTrue(maxDistance <= bitmap.width.toFloat() * 0.1f)
+        return@runBlocking
+    }
+
+    @Test
+    fun testDetectFaceInRotatedImage() = runBlocking {
+        val bitmap = InstrumentationRegistry.getInstrumentation()
+            .context.assets.open("image.jpg").use(BitmapFactory::decodeStream)
+        // Turn the image on its side as a camera sensor would deliver it
+        val rotated = Bitmap.createBitmap(bitmap, 0, 0, bitmap.width, bitmap.height, Matrix().apply { postRotate(90f) }, false)
+        val image = Image.fromBitmap(rotated)
+        val faces = FaceDetectionRetinaFace.create(
+            InstrumentationRegistry.getInstrumentation().targetContext
+        ).use { faceDetection ->
+            faceDetection.detectFacesInImage(image, 1, Rect(0, 0, image.width, image.height), rotationDegrees = 270)
+        }
+        Assert.assertEquals(1, faces.size)
+        val expectedLandmarks = loadExpectedFace().landmarks.map { PointF(bitmap.height - it.y, it.x) }
+        val maxDistance = faces[0].landmarks.zip(expectedLandmarks).maxOf { (p1, p2) -> p1.distanceTo(p2) }
+        Assert.assertTrue(maxDistance <= bitmap.width.toFloat() * 0.1f)
+        return@runBlocking
+    }
+
+    @Test
+    fun testDetectFaceInMirroredImage() = runBlocking {
+        val bitmap = InstrumentationRegistry.getInstrumentation()
+            .context.assets.open("image.jpg").use(BitmapFactory::decodeStream)
+        // Flip the image as a front camera would deliver it
+        val flipped = Bitmap.createBitmap(bitmap, 0, 0, bitmap.width, bitmap.height, Matrix().apply { preScale(-1f, 1f) }, false)
+        val image = Image.fromBitmap(flipped)
+        val (face, mirroredFace) = FaceDetectionRetinaFace.create(
+            InstrumentationRegistry.getInstrumentation().targetContext
+        ).use { faceDetection ->
+            val faces = faceDetection.detectFacesInImage(Image.fromBitmap(bitmap), 1)
+            val mirroredFaces = faceDetection.detectFacesInImage(image, 1, Rect(0, 0, image.width, image.height), mirrored = true)
+            Assert.assertEquals(1, faces.size)
+            Assert.assertEquals(1, mirroredFaces.size)
+            Pair(faces[0], mirroredFaces[0])
+        }
+        // The eye and mouth corner on the left of the flipped image are the mirrored right ones of the original
+        val expectedLandmarks = loadExpectedFace().landmarks.let { landmarks ->
+            intArrayOf(1, 0, 2, 4, 3).map { PointF(bitmap.width - landmarks[it].x, landmarks[it].y) }
+        }
+        val maxDistance = mirroredFace.landmarks.zip(expectedLandmarks).maxOf { (p1, p2) -> p1.distanceTo(p2) }
+        Assert.assertTrue(maxDistance <= bitmap.width.toFloat() * 0.1f)
+        Assert.assertEquals(face.leftEye.x < face.rightEye.x, mirroredFace.leftEye.x < mirroredFace.rightEye.x)
+        // The model sees the original image, so only the sign of yaw and roll changes
+        Assert.assertEquals(-face.angle.yaw, mirroredFace.angle.yaw, 0.01f)
+        Assert.assertEquals(face.angle.pitch, mirroredFace.angle.pitch, 0.01f)
+        Assert.assertEquals(-face.angle.roll, mirroredFace.angle.roll, 0.01f)
+        return@runBlocking
+    }
+
+    @Test
+    fun testDetectFaceInNv21Frame() = runBlocking {
+        val bitmap = InstrumentationRegistry.getInstrumentation()
+            .context.assets.open("image.jpg").use(BitmapFactory::decodeStream)
+        val width = bitmap.width and 1.inv()
+        val height = bitmap.height and 1.inv()
+        val nv21 = bitmap.toNv21(width, height)
+        val faces = FaceDetectionRetinaFace.create(
+            InstrumentationRegistry.getInstrumentation().targetContext
+        ).use { faceDetection ->
+            faceDetection.detectFacesInNv21(nv21, width, height, 1)
+        }
+        Assert.assertEquals(1, faces.size)
+        val expectedFace = loadExpectedFace()
+        Assert.assertTrue(compareFaces(faces[0], expectedFace, width.toFloat() * 0.1f))
+        return@runBlocking
+    }
+
+    @Test
+    fun testDetectFaceInGrayscaleFrame() = runBlocking {
+        val bitmap = InstrumentationRegistry.getInstrumentation()
+            .context.assets.open("image.jpg").use(BitmapFactory::decodeStream)
+        val width = bitmap.width and 1.inv()
+        val height = bitmap.height and 1.inv()
+        // The luma plane of the NV21 frame, one byte per pixel
+        val luma = bitmap.toNv21(width, height).apply { limit(width * height) }.slice()
+        val faces = FaceDetectionRetinaFace.create(
+            InstrumentationRegistry.getInstrumentation().targetContext
+        ).use { faceDetection ->
+            faceDetection.detectFacesInGrayscale(luma, width, height, 1)
+        }
+        Assert.assertEquals(1, faces.size)
+        val expectedFace = loadExpectedFace()
+        Assert.assertTrue(compareFaces(faces[0], expectedFace, width.toFloat() * 0.1f))
+        return@runBlocking
+    }
+
+    @Test
+    fun testDetectionDoesNotAllocateAfterWarmUp() = runBlocking {
+        val bitmap = InstrumentationRegistry.getInstrumentation()
+            .context.assets.open("image.jpg").use(BitmapFactory::decodeStream)
+        val image = Image.fromBitmap(bitmap)
+        FaceDetectionRetinaFace(
+            InstrumentationRegistry.getInstrumentation().targetContext,
+            SessionConfiguration.FP32
+        ).use { faceDetection ->
+            Assume.assumeNotNull(faceDetection.lastDetectionAllocations)
+            repeat(3) {
+                faceDetection.detectFacesInImage(image, 1, Rect(0, 0, image.width, image.height))
+            }
+            Assert.assertEquals(0L, faceDetection.lastDetectionAllocations)
+        }
+        return@runBlocking
+    }
+
+    @Test
+    fun testMovingRegionReusesResamplePlan() = runBlocking {
+        val bitmap = InstrumentationRegistry.getInstrumentation()
+            .context.assets.open("image.jpg").use(BitmapFactory::decodeStream)
+        val image = Image.fromBitmap(bitmap)
+        FaceDetectionRetinaFace(
+            InstrumentationRegistry.getInstrumentation().targetContext,
+            SessionConfiguration.FP32
+        ).use { faceDetection ->
+            val size = minOf(image.width, image.height) * 3 / 4
+            faceDetection.detectFacesInImage(image, 1, Rect(0, 0, size, size))
+            val (hits, misses) = faceDetection.planCacheCounts
+            // Same size at a new origin every frame, as when the region follows a face
+            val origins = listOf(Pair(2, 4), Pair(7, 3), Pair(image.width - size, image.height - size))
+            for ((x, y) in origins) {
+                faceDetection.detectFacesInImage(image, 1, Rect(x, y, x + size, y + size))
+            }
+            Assert.assertEquals(Pair(hits + origins.size, misses), faceDetection.planCacheCounts)
+        }
+        return@runBlocking
+    }
+
+    @Test
+    fun testPreprocessingKernelsMatchScalarReference() = runBlocking {
+        FaceDetectionRetinaFace(
+            InstrumentationRegistry.getInstrumentation().targetContext,
+            SessionConfiguration.FP32
+        ).use { faceDetection ->
+            Log.d("Ver-ID", "Preprocessing kernel: %s".format(faceDetection.preprocessingKernel))
+            Assert.assertTrue(faceDetection.verifyPreprocessingKernels())
+        }
+        return@runBlocking
+    }
+
+    @Test
+    fun testPostprocessingKernelsMatchScalarReference() = runBlocking {
+        FaceDetectionRetinaFace(
+            InstrumentationRegistry.getInstrumentation().targetContext,
+            SessionConfiguration.FP32
+        ).use { faceDetection ->
+            Log.d("Ver-ID", "Postprocessing kernel: %s".format(faceDetection.postprocessingKernel))
+            Assert.assertTrue(faceDetection.verifyPostprocessingKernels())
+        }
+        return@runBlocking
+    }
+
+    @Test
+    fun testNonMaxSuppressionMatchesReference() = runBlocking {
+        FaceDetectionRetinaFace(
+            InstrumentationRegistry.getInstrumentation().targetContext,
+            SessionConfiguration.FP32
+        ).use { faceDetection ->
+            Assert.assertTrue(faceDetection.verifyNonMaxSuppression())
+        }
+        return@runBlocking
+    }
+
+    @Test
+    fun testNonMaxSuppressionSpeedInCrowds() = runBlocking {
+        FaceDetectionRetinaFace(
+            InstrumentationRegistry.getInstrumentation().targetContext,
+            SessionConfiguration.FP32
+        ).use { faceDetection ->
+            // Peak extraction happens while decoding and leaves little to suppress
+            for (mode in SuppressionMode.entries - SuppressionMode.PEAKS) {
+                for (candidateCount in listOf(100, 300, 1000, 3000, 10000)) {
+                    val time = faceDetection.benchmarkNonMaxSuppression(candidateCount, mode.value, 100)
+                    Log.d("Ver-ID", "%s non-max suppression of %d candidates: %.1f µs".format(mode, candidateCount, time))
+                }
+            }
+        }
+        return@runBlocking
+    }
+
     @Test
     @Ignore
     fun testDetectFaceWithDifferentModelVariants() = runBlocking {
@@ -211,6 +616,27 @@ class FaceDetectionRetinaFaceTest {
     }
 }
 
+fun Bitmap.toNv21(width: Int, height: Int): ByteBuffer {
+    val pixels = IntArray(width * height)
+    getPixels(pixels, 0, width, 0, 0, width, height)
+    val nv21 = ByteBuffer.allocateDirect(width * height * 3 / 2)
+    for (y in 0..<height) {
+        for (x in 0..<width) {
+            val pixel = pixels[y * width + x]
+            val r = Color.red(pixel)
+            val g = Color.green(pixel)
+            val b = Color.blue(pixel)
+            nv21.put(y * width + x, (0.299f * r + 0.587f * g + 0.114f * b).roundToInt().coerceIn(0, 255).toByte())
+            if (x % 2 == 0 && y % 2 == 0) {
+                val chroma = width * height + (y / 2) * width + x
+                nv21.put(chroma, (128f + 0.5f * r - 0.418688f * g - 0.081312f * b).roundToInt().coerceIn(0, 255).toByte())
+                nv21.put(chroma + 1, (128f - 0.168736f * r - 0.331264f * g + 0.5f * b).roundToInt().coerceIn(0, 255).toByte())
+            }
+        }
+    }
+    return nv21
+}
+
 fun PointF.distanceTo(other: PointF): Float {
     return hypot(other.x - this.x, other.y - this.y)
 }
@@ -0,0 +1,42 @@
+#ifndef FACE_DETECTION_ALIGNEDALLOCATOR_H
+#define FACE_DETECTION_ALIGNEDALLOCATOR_H
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+namespace verid {
+
+    // Allocator for vectors whose data starts on a cache line, so SIMD loads of whole
+    // blocks never straddle one
+    template<typename T, std::size_t Alignment = 64>
+    struct AlignedAllocator {
+        using value_type = T;
+
+        template<typename U>
+        struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+        AlignedAllocator() = default;
+        template<typename U>
+        AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+        T* allocate(std::size_t n) {
+            return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+        }
+
+        void deallocate(T* p, std::size_t) {
+            ::operator delete(p, std::align_val_t(Alignment));
+        }
+
+        template<typename U>
+        bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+        template<typename U>
+        bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+    };
+
+    template<typename T>
+    using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+}
+
+#endif //FACE_DETECTION_ALIGNEDALLOCATOR_H
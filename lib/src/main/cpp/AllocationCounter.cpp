@@ -0,0 +1,72 @@
+#include "AllocationCounter.h"
+
+#ifdef FACE_DETECTION_COUNT_ALLOCATIONS
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+    std::atomic<size_t> allocations{0};
+
+    void* allocate(std::size_t size, std::size_t alignment) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        if (size == 0) size = 1;
+        void* p = nullptr;
+        if (alignment <= alignof(std::max_align_t)) {
+            p = std::malloc(size);
+        } else if (posix_memalign(&p, alignment, size) != 0) {
+            p = nullptr;
+        }
+        return p;
+    }
+
+    void* allocateOrThrow(std::size_t size, std::size_t alignment) {
+        void* p = allocate(size, alignment);
+        if (p == nullptr) throw std::bad_alloc();
+        return p;
+    }
+}
+
+// Every form allocates with malloc or posix_memalign, so every form of delete can free
+void* operator new(std::size_t size) { return allocateOrThrow(size, 0); }
+void* operator new[](std::size_t size) { return allocateOrThrow(size, 0); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return allocate(size, 0); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return allocate(size, 0); }
+void* operator new(std::size_t size, std::align_val_t alignment) { return allocateOrThrow(size, static_cast<std::size_t>(alignment)); }
+void* operator new[](std::size_t size, std::align_val_t alignment) { return allocateOrThrow(size, static_cast<std::size_t>(alignment)); }
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return allocate(size, static_cast<std::size_t>(alignment)); }
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return allocate(size, static_cast<std::size_t>(alignment)); }
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { std::free(p); }
+
+namespace verid {
+
+    bool isCountingAllocations() { return true; }
+
+    size_t allocationCount() { return allocations.load(std::memory_order_relaxed); }
+
+}
+
+#else
+
+namespace verid {
+
+    bool isCountingAllocations() { return false; }
+
+    size_t allocationCount() { return 0; }
+
+}
+
+#endif
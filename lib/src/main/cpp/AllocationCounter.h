@@ -0,0 +1,17 @@
+#ifndef FACE_DETECTION_ALLOCATIONCOUNTER_H
+#define FACE_DETECTION_ALLOCATIONCOUNTER_H
+
+#include <cstddef>
+
+namespace verid {
+
+    // Whether the library was built with FACE_DETECTION_COUNT_ALLOCATIONS, which replaces the global
+    // operator new to count every heap allocation made by the library's code
+    bool isCountingAllocations();
+
+    // Heap allocations made so far on any thread, always zero when not counting
+    size_t allocationCount();
+
+}
+
+#endif //FACE_DETECTION_ALLOCATIONCOUNTER_H
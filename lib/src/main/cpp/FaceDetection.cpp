@@ -5,9 +5,12 @@
 #include "FaceDetection.h"
 #include "Postprocessing.h"
 #include "OptimalSessionSettingsSelector.h"
+#include "ModelReader.h"
+#include "AllocationCounter.h"
 #include <onnxruntime/core/session/onnxruntime_cxx_api.h>
 #include <onnxruntime/core/providers/nnapi/nnapi_provider_factory.h>
 #include <android/log.h>
+#include <algorithm>
 #include <chrono>
 #include <vector>
 #include <cstdint>
@@ -20,16 +23,162 @@ constexpr int IMAGE_SIZE = 320;
 
 namespace verid {
 
-    FaceDetection::FaceDetection(const std::string &modelPath, Ort::SessionOptions options)
-            : env_(ORT_LOGGING_LEVEL_WARNING, LOG_TAG),
-              session_(env_, modelPath.c_str(), options),
-              postprocessing_(IMAGE_SIZE, IMAGE_SIZE),
-              preprocessing_(IMAGE_SIZE)
+    FaceDetection::FaceDetection(const std::string &modelPath, Ort::SessionOptions options, int parallelism, InputFormat inputFormat)
+            : env_(acquireEnvironment()),
+              session_(createSession(*env_, modelPath, {}, useEnvironmentThreadPools(options), inputFormat)),
+              memoryInfo_(Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault)),
+              binding_(session_),
+              modelPath_(modelPath),
+              defaultInputWidth_(IMAGE_SIZE),
+              defaultInputHeight_(IMAGE_SIZE),
+              workerPool_(parallelism),
+              postprocessing_(IMAGE_SIZE, IMAGE_SIZE, workerPool_),
+              preprocessing_(IMAGE_SIZE, workerPool_)
     {
-        loadModelIO();
+        loadModelIO(modelPath);
     }
 
-    void FaceDetection::loadModelIO() {
+    namespace {
+        // Suffix of the half precision inputs and outputs added to float models
+        const std::string HALF_SUFFIX = "_fp16";
+        // Suffix of the quantized input added to QDQ models
+        const std::string QUANTIZED_SUFFIX = "_quantized";
+        // Strides of the model's feature maps divide the input height and width
+        constexpr int INPUT_SIZE_MULTIPLE = 32;
+
+        Ort::Node castNode(const std::string &name, const std::string &input, const std::string &output,
+                           ONNXTensorElementDataType type) {
+            const int64_t to = type;
+            std::vector<Ort::OpAttr> attributes;
+            attributes.emplace_back("to", &to, 1, OrtOpAttrType::ORT_OP_ATTR_INT);
+            return {"Cast", "", name, {input}, {output}, attributes};
+        }
+
+        Ort::ValueInfo tensorValueInfo(const std::string &name, ONNXTensorElementDataType type, const std::vector<int64_t> &shape) {
+            Ort::TensorTypeAndShapeInfo tensorInfo(type, shape);
+            Ort::TypeInfo typeInfo = Ort::TypeInfo::CreateTensorInfo(tensorInfo.GetConst());
+            return Ort::ValueInfo(name, typeInfo.GetConst());
+        }
+
+        // Shape of the model's NCHW input, with -1 for dynamic dimensions
+        std::vector<int64_t> modelInputShape(const Ort::Session &session) {
+            std::vector<int64_t> shape = session.GetInputTypeInfo(0).GetTensorTypeAndShapeInfo().GetShape();
+            if (shape.size() != 4) {
+                throw std::runtime_error("Unsupported model input shape");
+            }
+            return shape;
+        }
+
+        // uint8 NHWC -> Transpose -> Cast -> Sub(mean) -> the model's float NCHW input
+        void addByteInput(const Ort::Session &session, Ort::Graph &graph) {
+            const std::string modelInput = session.GetInputNames().at(0);
+            const std::vector<int64_t> shape = modelInputShape(session);
+            std::vector<Ort::ValueInfo> inputs;
+            inputs.push_back(tensorValueInfo("input_rgb", ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT8, {shape[0], shape[2], shape[3], 3}));
+            graph.SetInputs(inputs);
+
+            const int64_t perm[] = {0, 3, 1, 2};
+            std::vector<Ort::OpAttr> transposeAttrs;
+            transposeAttrs.emplace_back("perm", perm, 4, OrtOpAttrType::ORT_OP_ATTR_INTS);
+            Ort::Node transpose("Transpose", "", "input_rgb_transpose", {"input_rgb"}, {"input_rgb_nchw"}, transposeAttrs);
+            graph.AddNode(transpose);
+
+            Ort::Node cast = castNode("input_rgb_cast", "input_rgb_nchw", "input_rgb_float", ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT);
+            graph.AddNode(cast);
+
+            Ort::AllocatorWithDefaultOptions allocator;
+            const std::vector<int64_t> meanShape = {1, 3, 1, 1};
+            Ort::Value mean = Ort::Value::CreateTensor<float>(allocator, meanShape.data(), meanShape.size());
+            float* meanData = mean.GetTensorMutableData<float>();
+            meanData[0] = 104.0f;
+            meanData[1] = 117.0f;
+            meanData[2] = 123.0f;
+            graph.AddInitializer("input_rgb_mean", mean, false);
+            Ort::Node sub("Sub", "", "input_rgb_sub", {"input_rgb_float", "input_rgb_mean"}, {modelInput});
+            graph.AddNode(sub);
+        }
+
+        // Quantized input -> DequantizeLinear -> the model's float input. The model's leading QuantizeLinear
+        // then follows a DequantizeLinear with the same parameters and the pair is removed when the
+        // session is optimised, so the model runs from the quantized input directly.
+        void addQuantizedInput(const Ort::Session &session, Ort::Graph &graph, const InputQuantization &quantization) {
+            const std::string modelInput = session.GetInputNames().at(0);
+            const std::string input = modelInput + QUANTIZED_SUFFIX;
+            const ONNXTensorElementDataType type = quantization.isSigned
+                    ? ONNX_TENSOR_ELEMENT_DATA_TYPE_INT8 : ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT8;
+            std::vector<Ort::ValueInfo> inputs;
+            inputs.push_back(tensorValueInfo(input, type, modelInputShape(session)));
+            graph.SetInputs(inputs);
+
+            Ort::AllocatorWithDefaultOptions allocator;
+            const std::vector<int64_t> scalarShape;
+            Ort::Value scale = Ort::Value::CreateTensor<float>(allocator, scalarShape.data(), 0);
+            *scale.GetTensorMutableData<float>() = quantization.scale;
+            graph.AddInitializer(input + "_scale", scale, false);
+            Ort::Value zeroPoint = Ort::Value::CreateTensor(allocator, scalarShape.data(), 0, type);
+            *zeroPoint.GetTensorMutableData<uint8_t>() = static_cast<uint8_t>(quantization.zeroPoint);
+            graph.AddInitializer(input + "_zero_point", zeroPoint, false);
+            Ort::Node dequantize("DequantizeLinear", "", input + "_dequantize",
+                                 {input, input + "_scale", input + "_zero_point"}, {modelInput});
+            graph.AddNode(dequantize);
+        }
+
+        // Half precision inputs and outputs for a model that converts float IO to fp16 internally.
+        // The added casts pair up with the model's own (fp16 -> float -> fp16) and, being lossless,
+        // are removed together with them when the session is optimised.
+        void addHalfPrecisionIO(const Ort::Session &session, Ort::Graph &graph) {
+            std::vector<Ort::ValueInfo> inputs;
+            for (size_t i = 0; i < session.GetInputCount(); ++i) {
+                const std::string name = session.GetInputNames().at(i);
+                const auto shape = session.GetInputTypeInfo(i).GetTensorTypeAndShapeInfo().GetShape();
+                inputs.push_back(tensorValueInfo(name + HALF_SUFFIX, ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16, shape));
+                Ort::Node cast = castNode(name + "_cast", name + HALF_SUFFIX, name, ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT);
+                graph.AddNode(cast);
+            }
+            std::vector<Ort::ValueInfo> outputs;
+            for (size_t i = 0; i < session.GetOutputCount(); ++i) {
+                const std::string name = session.GetOutputNames().at(i);
+                const auto shape = session.GetOutputTypeInfo(i).GetTensorTypeAndShapeInfo().GetShape();
+                outputs.push_back(tensorValueInfo(name + HALF_SUFFIX, ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16, shape));
+                Ort::Node cast = castNode(name + "_cast", name, name + HALF_SUFFIX, ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16);
+                graph.AddNode(cast);
+            }
+            graph.SetInputs(inputs);
+            graph.SetOutputs(outputs);
+        }
+    }
+
+    Ort::Session FaceDetection::createSession(const Ort::Env &env, const std::string &modelPath,
+                                              const std::vector<unsigned char> &modelData,
+                                              const Ort::SessionOptions &options, InputFormat inputFormat) {
+        if (inputFormat != InputFormat::FLOAT_NCHW) {
+            try {
+                Ort::Session session = modelData.empty()
+                        ? Ort::Session::CreateModelEditorSession(env, modelPath.c_str(), options)
+                        : Ort::Session::CreateModelEditorSession(env, modelData.data(), modelData.size(), options);
+                Ort::Graph graph;
+                if (inputFormat == InputFormat::UINT8_NHWC) {
+                    addByteInput(session, graph);
+                } else if (inputFormat == InputFormat::QUANTIZED_NCHW) {
+                    addQuantizedInput(session, graph, readInputQuantization(modelPath, session.GetInputNames().at(0)));
+                } else {
+                    addHalfPrecisionIO(session, graph);
+                }
+                Ort::Model model({{"", session.GetOpset("")}});
+                model.AddGraph(graph);
+                session.FinalizeModelEditorSession(model, options);
+                return session;
+            } catch (const std::exception &e) {
+                LOGI("Cannot adapt the model to the requested input format, using float input: %s", e.what());
+            }
+        }
+        if (!modelData.empty()) {
+            return {env, modelData.data(), modelData.size(), options};
+        }
+        return {env, modelPath.c_str(), options};
+    }
+
+    void FaceDetection::loadModelIO(const std::string &modelPath) {
         size_t inputCount = session_.GetInputCount();
         size_t outputCount = session_.GetOutputCount();
         inputNames_.clear();
@@ -42,73 +191,519 @@ namespace verid {
             Ort::AllocatedStringPtr name = session_.GetOutputNameAllocated(i, allocator_);
             outputNames_.push_back(strdup(name.get()));  // strdup to persist
         }
+        Ort::TypeInfo inputInfo = session_.GetInputTypeInfo(0);
+        auto tensorInfo = inputInfo.GetTensorTypeAndShapeInfo();
+        const ONNXTensorElementDataType inputType = tensorInfo.GetElementType();
+        const std::vector<int64_t> inputShape = tensorInfo.GetShape();
+        switch (inputType) {
+            case ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT8:
+            case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT8:
+                if (inputShape.size() == 4 && inputShape[1] == 3) {
+                    // Quantization of an added input is that of the model input it replaces
+                    std::string inputName = inputNames_[0];
+                    if (inputName.size() > QUANTIZED_SUFFIX.size() &&
+                        inputName.compare(inputName.size() - QUANTIZED_SUFFIX.size(), QUANTIZED_SUFFIX.size(), QUANTIZED_SUFFIX) == 0) {
+                        inputName.resize(inputName.size() - QUANTIZED_SUFFIX.size());
+                    }
+                    const InputQuantization quantization = readInputQuantization(modelPath, inputName);
+                    if (quantization.isSigned != (inputType == ONNX_TENSOR_ELEMENT_DATA_TYPE_INT8)) {
+                        throw std::runtime_error("Model input type does not match its quantization");
+                    }
+                    preprocessing_.setInputQuantization(quantization);
+                    signedQuantizedInput_ = quantization.isSigned;
+                    inputFormat_ = InputFormat::QUANTIZED_NCHW;
+                    break;
+                }
+                if (inputType != ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT8 || inputShape.size() != 4 || inputShape[3] != 3) {
+                    throw std::runtime_error("Unsupported 8-bit model input shape");
+                }
+                inputFormat_ = InputFormat::UINT8_NHWC;
+                break;
+            case ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16:
+                inputFormat_ = InputFormat::FLOAT16_NCHW;
+                break;
+            default:
+                inputFormat_ = InputFormat::FLOAT_NCHW;
+                break;
+        }
+        if (inputShape.size() != 4) {
+            throw std::runtime_error("Unsupported model input shape");
+        }
+        const bool channelsLast = inputFormat_ == InputFormat::UINT8_NHWC;
+        const int64_t inputHeight = inputShape[channelsLast ? 1 : 2];
+        const int64_t inputWidth = inputShape[channelsLast ? 2 : 3];
+        dynamicInputSize_ = inputHeight <= 0 && inputWidth <= 0;
+        if (!dynamicInputSize_) {
+            if (inputHeight <= 0 || inputWidth <= 0) {
+                throw std::runtime_error("Model input must have both or neither of height and width dynamic");
+            }
+            defaultInputWidth_ = static_cast<int>(inputWidth);
+            defaultInputHeight_ = static_cast<int>(inputHeight);
+        }
+        preprocessing_.setTargetSize(defaultInputWidth_, defaultInputHeight_);
+        // Outputs are found by name, with or without the half precision suffix
+        const char* names[] = {"boxes", "scores", "landmarks"};
+        for (size_t n = 0; n < outputIndices_.size(); ++n) {
+            auto match = std::find_if(outputNames_.begin(), outputNames_.end(), [&](const char* name) {
+                return name == std::string(names[n]) || name == names[n] + HALF_SUFFIX;
+            });
+            if (match == outputNames_.end()) {
+                throw std::runtime_error(std::string("Model has no ") + names[n] + " output");
+            }
+            outputIndices_[n] = static_cast<size_t>(match - outputNames_.begin());
+        }
+        halfPrecisionOutputs_ = session_.GetOutputTypeInfo(outputIndices_[0]).GetTensorTypeAndShapeInfo().GetElementType()
+                == ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16;
+        // Room for every prior passing the threshold, so no frame at the default size grows the arena
+        detections_.reserve(postprocessing_.priorCount(defaultInputWidth_, defaultInputHeight_));
+    }
+
+    template<typename Fn>
+    int FaceDetection::countAllocations(Fn &&detectFrame) {
+        const size_t allocationsBefore = allocationCount();
+        inferenceAllocations_ = 0;
+        const int faceCount = detectFrame();
+        detectionAllocations_ = allocationCount() - allocationsBefore - inferenceAllocations_;
+        return faceCount;
+    }
+
+    template<typename Fn>
+    InputTransform FaceDetection::preprocess(Fn &&preprocessInto) {
+        switch (inputFormat_) {
+            case InputFormat::UINT8_NHWC: return preprocessInto(byteInputBuffer_);
+            case InputFormat::FLOAT16_NCHW: return preprocessInto(halfInputBuffer_);
+            case InputFormat::QUANTIZED_NCHW: return preprocessInto(quantizedInputBuffer_);
+            default: return preprocessInto(inputBuffer_);
+        }
+    }
+
+    void FaceDetection::selectInputSize(const InputSize &inputSize, const Region &region, const Orientation &orientation) {
+        const bool explicitSize = inputSize.width > 0 || inputSize.height > 0;
+        if (!dynamicInputSize_) {
+            if (explicitSize && !inputSize.matchAspectRatio &&
+                (inputSize.width != defaultInputWidth_ || inputSize.height != defaultInputHeight_)) {
+                throw std::invalid_argument("Model input size is fixed");
+            }
+            preprocessing_.setTargetSize(defaultInputWidth_, defaultInputHeight_);
+            return;
+        }
+        if (inputSize.matchAspectRatio) {
+            const bool swapAxes = orientation.rotation == 90 || orientation.rotation == 270;
+            const int64_t uprightWidth = swapAxes ? region.height : region.width;
+            const int64_t uprightHeight = swapAxes ? region.width : region.height;
+            const int longSide = explicitSize ? std::max(inputSize.width, inputSize.height)
+                                              : std::max(defaultInputWidth_, defaultInputHeight_);
+            if (longSide % INPUT_SIZE_MULTIPLE != 0) {
+                throw std::invalid_argument("Input size must be a multiple of 32");
+            }
+            // Round the shorter side up so the whole region fits
+            auto fitted = [&](int64_t side, int64_t other) {
+                const int64_t size = (longSide * side + other - 1) / other;
+                return static_cast<int>(std::max<int64_t>(INPUT_SIZE_MULTIPLE,
+                        (size + INPUT_SIZE_MULTIPLE - 1) / INPUT_SIZE_MULTIPLE * INPUT_SIZE_MULTIPLE));
+            };
+            if (uprightWidth >= uprightHeight) {
+                preprocessing_.setTargetSize(longSide, fitted(uprightHeight, uprightWidth));
+            } else {
+                preprocessing_.setTargetSize(fitted(uprightWidth, uprightHeight), longSide);
+            }
+            return;
+        }
+        if (!explicitSize) {
+            preprocessing_.setTargetSize(defaultInputWidth_, defaultInputHeight_);
+            return;
+        }
+        if (inputSize.width <= 0 || inputSize.height <= 0 ||
+            inputSize.width % INPUT_SIZE_MULTIPLE != 0 || inputSize.height % INPUT_SIZE_MULTIPLE != 0) {
+            throw std::invalid_argument("Input size must be a multiple of 32");
+        }
+        preprocessing_.setTargetSize(inputSize.width, inputSize.height);
+    }
+
+    int FaceDetection::detectFaces(void *imageData, int width, int height, int bytesPerRow, int format, const Region &region,
+                                    const Orientation &orientation, const InputSize &inputSize, int limit, float *buffer) {
+        return countAllocations([&] {
+            selectInputSize(inputSize, region, orientation);
+            InputTransform transform = preprocess([&](auto &input) {
+                return preprocessing_.preprocessBitmap(imageData, width, height, bytesPerRow, format, region, orientation, input);
+            });
+            detections_.clear();
+            detect(inputTensor(), transform, deferLandmarks());
+            return writeFaces(limit, buffer);
+        });
+    }
+
+    int FaceDetection::detectFaces(const YuvImage &image, const Region &region, const Orientation &orientation,
+                                    const InputSize &inputSize, int limit, float *buffer) {
+        return countAllocations([&] {
+            selectInputSize(inputSize, region, orientation);
+            InputTransform transform = preprocess([&](auto &input) {
+                return preprocessing_.preprocessYuv(image, region, orientation, input);
+            });
+            detections_.clear();
+            detect(inputTensor(), transform, deferLandmarks());
+            return writeFaces(limit, buffer);
+        });
+    }
+
+    namespace {
+        // Returns preprocessing to single images however the batch call ends
+        struct BatchSlotReset {
+            Preprocessing &preprocessing;
+            ~BatchSlotReset() { preprocessing.setBatchSlot(0, 1); }
+        };
+    }
+
+    int FaceDetection::detectFacesInTiles(void *imageData, int width, int height, int bytesPerRow, int format,
+                                          const Orientation &orientation, const TilingOptions &tiling, int limit, float *buffer) {
+        return countAllocations([&] {
+            preprocessing_.setTargetSize(defaultInputWidth_, defaultInputHeight_);
+            detections_.clear();
+            const std::vector<Region> tiles = tileRegions(width, height, std::max(defaultInputWidth_, defaultInputHeight_), tiling);
+            // Drops the detections of a tile, from first on, that its edges cut off inside the image
+            auto dropCutFaces = [&](size_t first, const Region &tile) {
+                detections_.erase(std::remove_if(detections_.begin() + static_cast<std::ptrdiff_t>(first), detections_.end(),
+                                                 [&](const DetectionBox &det) {
+                                                     return isCutByTileEdge(det.bounds, tile, width, height);
+                                                 }),
+                                  detections_.end());
+            };
+            // Each tile's outputs are overwritten by the next run, so its landmarks are decoded right away
+            Ort::Session &session = batchSession();
+            if (!session) {
+                // Tiles run one after another on the session, which already spreads each run over its threads
+                for (const Region &tile : tiles) {
+                    InputTransform transform = preprocess([&](auto &input) {
+                        return preprocessing_.preprocessBitmap(imageData, width, height, bytesPerRow, format, tile, orientation, input);
+                    });
+                    const size_t first = detections_.size();
+                    detect(inputTensor(), transform, false);
+                    dropCutFaces(first, tile);
+                }
+                return writeFaces(limit, buffer);
+            }
+            BatchSlotReset reset{preprocessing_};
+            std::array<InputTransform, MAX_BATCH_SIZE> transforms;
+            const int tileCount = static_cast<int>(tiles.size());
+            for (int firstTile = 0; firstTile < tileCount; firstTile += MAX_BATCH_SIZE) {
+                const int batchSize = std::min(MAX_BATCH_SIZE, tileCount - firstTile);
+                for (int slot = 0; slot < batchSize; ++slot) {
+                    preprocessing_.setBatchSlot(slot, batchSize);
+                    transforms[slot] = preprocess([&](auto &input) {
+                        return preprocessing_.preprocessBitmap(imageData, width, height, bytesPerRow, format,
+                                                               tiles[firstTile + slot], orientation, input);
+                    });
+                }
+                runBatch(batchSize);
+                for (int slot = 0; slot < batchSize; ++slot) {
+                    const size_t first = detections_.size();
+                    decodeOutputs(batchOutputs(slot), transforms[slot], false);
+                    dropCutFaces(first, tiles[firstTile + slot]);
+                }
+            }
+            return writeFaces(limit, buffer);
+        });
+    }
+
+    void FaceDetection::detectFacesInBatch(const BatchImage *images, int count, int limit, float *buffer, int *counts) {
+        if (count < 0 || (count > 0 && (!images || !counts))) {
+            throw std::invalid_argument("Invalid batch");
+        }
+        countAllocations([&] {
+            preprocessing_.setTargetSize(defaultInputWidth_, defaultInputHeight_);
+            Ort::Session &session = batchSession();
+            const int maxBatchSize = session ? MAX_BATCH_SIZE : 1;
+            BatchSlotReset reset{preprocessing_};
+            std::array<InputTransform, MAX_BATCH_SIZE> transforms;
+            int faceCount = 0;
+            for (int first = 0; first < count; first += maxBatchSize) {
+                const int batchSize = std::min(maxBatchSize, count - first);
+                for (int slot = 0; slot < batchSize; ++slot) {
+                    const BatchImage &image = images[first + slot];
+                    const Region region{0, 0, image.width, image.height};
+                    preprocessing_.setBatchSlot(slot, batchSize);
+                    transforms[slot] = preprocess([&](auto &input) {
+                        return preprocessing_.preprocessBitmap(image.data, image.width, image.height, image.bytesPerRow,
+                                                               image.format, region, image.orientation, input);
+                    });
+                }
+                if (!session) {
+                    detections_.clear();
+                    detect(inputTensor(), transforms[0], deferLandmarks());
+                    counts[first] = writeFaces(limit, buffer + static_cast<size_t>(first) * limit * 18);
+                    faceCount += counts[first];
+                    continue;
+                }
+                runBatch(batchSize);
+                // Each image's detections are suppressed and written before the next slot is decoded
+                for (int slot = 0; slot < batchSize; ++slot) {
+                    detections_.clear();
+                    decodeOutputs(batchOutputs(slot), transforms[slot], deferLandmarks());
+                    const int index = first + slot;
+                    counts[index] = writeFaces(limit, buffer + static_cast<size_t>(index) * limit * 18);
+                    faceCount += counts[index];
+                }
+            }
+            return faceCount;
+        });
     }
 
-    void toFloatVector(const Ort::Value& output, std::vector<float>& out) {
-        const auto* dataPtr = output.GetTensorData<float>();
-        auto typeInfo = output.GetTensorTypeAndShapeInfo();
-        auto shape = typeInfo.GetShape();
-        size_t totalElements = 1;
-        for (auto dim : shape) {
-            totalElements *= dim;
+    void FaceDetection::runBatch(int batchSize) {
+        if (batchSize != batchOutputSize_) {
+            batchOutputTensors_ = createOutputTensors(batchSize);
+            batchBinding_.ClearBoundOutputs();
+            for (size_t n = 0; n < outputNames_.size(); ++n) {
+                if (batchOutputTensors_[n]) {
+                    batchBinding_.BindOutput(outputNames_[n], batchOutputTensors_[n]);
+                } else {
+                    batchBinding_.BindOutput(outputNames_[n], memoryInfo_);
+                }
+            }
+            batchOutputSize_ = batchSize;
+        }
+        const void* data = inputData();
+        if (!batchInput_ || batchSize != batchInputSize_ || data != batchInputData_) {
+            batchInput_ = createInputTensor(batchSize);
+            batchBinding_.BindInput(inputNames_[0], batchInput_);
+            batchInputSize_ = batchSize;
+            batchInputData_ = data;
         }
-        out.assign(dataPtr, dataPtr + totalElements);
+        const size_t allocationsBefore = allocationCount();
+        batchSession_.Run(runOptions_, batchBinding_);
+        inferenceAllocations_ += allocationCount() - allocationsBefore;
     }
 
-    int FaceDetection::detectFaces(void *imageData, int width, int height, int bytesPerRow, int format, int limit, float *buffer) {
-        const size_t requiredSize = 3 * IMAGE_SIZE * IMAGE_SIZE;
-        if (inputBuffer_.size() != requiredSize) {
-            inputBuffer_.resize(requiredSize);
+    ModelOutputs FaceDetection::batchOutputs(int slot) {
+        ModelOutputs outputs;
+        outputs.count = postprocessing_.priorCount(defaultInputWidth_, defaultInputHeight_);
+        const size_t elementSize = halfPrecisionOutputs_ ? sizeof(uint16_t) : sizeof(float);
+        auto slotData = [&](size_t output, int valuesPerPrior) {
+            return static_cast<const unsigned char*>(batchOutputTensors_[outputIndices_[output]].GetTensorRawData()) +
+                   static_cast<size_t>(slot) * outputs.count * valuesPerPrior * elementSize;
+        };
+        outputs.boxes = slotData(0, 4);
+        outputs.scores = slotData(1, 2);
+        outputs.landmarks = slotData(2, 10);
+        outputs.halfPrecision = halfPrecisionOutputs_;
+        outputs.inputWidth = defaultInputWidth_;
+        outputs.inputHeight = defaultInputHeight_;
+        return outputs;
+    }
+
+    Ort::Session &FaceDetection::batchSession() {
+        if (batchSessionLoaded_) {
+            return batchSession_;
+        }
+        batchSessionLoaded_ = true;
+        try {
+            // Accelerators compile for fixed shapes, so the batch runs on the CPU
+            Ort::SessionOptions options;
+            options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_EXTENDED);
+            options.SetLogSeverityLevel(ORT_LOGGING_LEVEL_WARNING);
+            Ort::Session session = createSession(*env_, modelPath_, readModelWithDynamicBatch(modelPath_),
+                                                 useEnvironmentThreadPools(options), inputFormat_);
+            const ONNXTensorElementDataType inputType = session.GetInputTypeInfo(0).GetTensorTypeAndShapeInfo().GetElementType();
+            if (inputType != session_.GetInputTypeInfo(0).GetTensorTypeAndShapeInfo().GetElementType() ||
+                session.GetInputNames().at(0) != inputNames_[0] || session.GetOutputNames().size() != outputNames_.size()) {
+                throw std::runtime_error("Batch model input does not match the model");
+            }
+            batchSession_ = std::move(session);
+            batchBinding_ = Ort::IoBinding(batchSession_);
+        } catch (const std::exception &e) {
+            LOGI("Cannot give the model a dynamic batch, detecting images one by one: %s", e.what());
         }
-        preprocessing_.preprocessBitmap(imageData, width, height, bytesPerRow, format, inputBuffer_);
-        return detectFaces(inputBuffer_, limit, buffer);
+        return batchSession_;
     }
 
     int FaceDetection::detectFaces(std::vector<float> &input, const int limit, float *buffer) {
-        if (input.size() != 3 * IMAGE_SIZE * IMAGE_SIZE) {
+        if (inputFormat_ != InputFormat::FLOAT_NCHW) {
+            throw std::runtime_error("Model does not take float input");
+        }
+        const size_t expectedSize = 3 * static_cast<size_t>(defaultInputWidth_) * defaultInputHeight_;
+        if (input.size() != expectedSize) {
             std::ostringstream oss;
-            oss << "Invalid input size: " << input.size() << ". Expected " << 3 * IMAGE_SIZE * IMAGE_SIZE << ".";
+            oss << "Invalid input size: " << input.size() << ". Expected " << expectedSize << ".";
             throw std::runtime_error(oss.str());
         }
-        std::vector<int64_t> inputShape = {1, 3, IMAGE_SIZE, IMAGE_SIZE};
-        Ort::MemoryInfo memoryInfo = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
-        Ort::Value inputTensor = Ort::Value::CreateTensor<float>(
-                memoryInfo,
-                input.data(),
-                input.size(),
-                inputShape.data(),
-                inputShape.size()
-        );
-        std::vector<Ort::Value> inputTensors;
-        inputTensors.emplace_back(std::move(inputTensor));
-        std::vector<Ort::Value> outputTensors;
-        outputTensors.resize(outputNames_.size());
-        // Run inference
-        session_.Run(
-                Ort::RunOptions{nullptr},
-                inputNames_.data(),
-                inputTensors.data(),
-                inputTensors.size(),
-                outputNames_.data(),
-                outputTensors.data(),
-                outputTensors.size()
-        );
-        std::unordered_map<std::string, Ort::Value> outputMap;
-        for (size_t i = 0; i < outputNames_.size(); ++i) {
-            outputMap[outputNames_[i]] = std::move(outputTensors[i]);
-        }
-        toFloatVector(outputMap["boxes"], boxes_);
-        toFloatVector(outputMap["scores"], scores_);
-        toFloatVector(outputMap["landmarks"], landmarks_);
-        // Decode boxes
-        std::vector<DetectionBox> detections = postprocessing_.decode(boxes_, scores_, landmarks_);
-        // NMS
-        detections = verid::Postprocessing::nonMaxSuppression(detections, 0.4f, limit);
-        int numFaces = std::min(static_cast<int>(detections.size()), limit);
-        // Fill the face buffer
+        preprocessing_.setTargetSize(defaultInputWidth_, defaultInputHeight_);
+        const int64_t inputShape[] = {1, 3, defaultInputHeight_, defaultInputWidth_};
+        Ort::Value tensor = Ort::Value::CreateTensor<float>(memoryInfo_, input.data(), input.size(), inputShape, 4);
+        return countAllocations([&] {
+            detections_.clear();
+            detect(tensor, InputTransform{}, deferLandmarks());
+            return writeFaces(limit, buffer);
+        });
+    }
+
+    const void* FaceDetection::inputData() const {
+        switch (inputFormat_) {
+            case InputFormat::UINT8_NHWC: return byteInputBuffer_.data();
+            case InputFormat::FLOAT16_NCHW: return halfInputBuffer_.data();
+            case InputFormat::QUANTIZED_NCHW: return quantizedInputBuffer_.data();
+            default: return inputBuffer_.data();
+        }
+    }
+
+    Ort::Value &FaceDetection::inputTensor() {
+        const void* data = inputData();
+        if (input_ && data == inputData_ && preprocessing_.width() == inputWidth_ && preprocessing_.height() == inputHeight_) {
+            return input_;
+        }
+        inputData_ = data;
+        inputBound_ = false;
+        inputWidth_ = preprocessing_.width();
+        inputHeight_ = preprocessing_.height();
+        input_ = createInputTensor(1);
+        return input_;
+    }
+
+    Ort::Value FaceDetection::createInputTensor(int batchSize) {
+        const int64_t height = preprocessing_.height();
+        const int64_t width = preprocessing_.width();
+        const size_t elements = static_cast<size_t>(batchSize) * 3 * height * width;
+        if (inputFormat_ == InputFormat::UINT8_NHWC) {
+            const int64_t inputShape[] = {batchSize, height, width, 3};
+            return Ort::Value::CreateTensor<uint8_t>(memoryInfo_, byteInputBuffer_.data(), elements, inputShape, 4);
+        }
+        const int64_t inputShape[] = {batchSize, 3, height, width};
+        if (inputFormat_ == InputFormat::FLOAT16_NCHW) {
+            return Ort::Value::CreateTensor(memoryInfo_, halfInputBuffer_.data(), elements * sizeof(uint16_t),
+                                            inputShape, 4, ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16);
+        }
+        if (inputFormat_ == InputFormat::QUANTIZED_NCHW) {
+            return Ort::Value::CreateTensor(memoryInfo_, quantizedInputBuffer_.data(), elements, inputShape, 4,
+                                            signedQuantizedInput_ ? ONNX_TENSOR_ELEMENT_DATA_TYPE_INT8 : ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT8);
+        }
+        return Ort::Value::CreateTensor<float>(memoryInfo_, inputBuffer_.data(), elements, inputShape, 4);
+    }
+
+    std::vector<Ort::Value> FaceDetection::createOutputTensors(int batchSize) {
+        const int64_t count = postprocessing_.priorCount(preprocessing_.width(), preprocessing_.height());
+        std::vector<Ort::Value> tensors(outputNames_.size());
+        const ONNXTensorElementDataType type = halfPrecisionOutputs_
+                ? ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16 : ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT;
+        const int64_t valuesPerPrior[] = {4, 2, 10};
+        for (size_t n = 0; n < outputIndices_.size(); ++n) {
+            const int64_t shape[] = {batchSize, count, valuesPerPrior[n]};
+            tensors[outputIndices_[n]] = Ort::Value::CreateTensor(allocator_, shape, 3, type);
+        }
+        return tensors;
+    }
 
+    void FaceDetection::prepareOutputs() {
+        const int width = preprocessing_.width();
+        const int height = preprocessing_.height();
+        if (!outputTensors_.empty() && width == outputWidth_ && height == outputHeight_) {
+            return;
+        }
+        outputCount_ = postprocessing_.priorCount(width, height);
+        outputTensors_ = createOutputTensors(1);
+        // Any other outputs are left for the session to allocate in the arena
+        binding_.ClearBoundOutputs();
+        for (size_t n = 0; n < outputNames_.size(); ++n) {
+            if (outputTensors_[n]) {
+                binding_.BindOutput(outputNames_[n], outputTensors_[n]);
+            } else {
+                binding_.BindOutput(outputNames_[n], memoryInfo_);
+            }
+        }
+        outputWidth_ = width;
+        outputHeight_ = height;
+    }
+
+    void FaceDetection::detect(Ort::Value &input, const InputTransform &transform, bool deferLandmarks) {
+        prepareOutputs();
+        // Tensors other than the cached input are bound for this run only
+        if (&input != &input_ || !inputBound_) {
+            binding_.BindInput(inputNames_[0], input);
+            inputBound_ = &input == &input_;
+        }
+        // The session's own bookkeeping is outside the detector's control and not counted against it
+        const size_t allocationsBefore = allocationCount();
+        session_.Run(runOptions_, binding_);
+        inferenceAllocations_ += allocationCount() - allocationsBefore;
+        // Decode boxes straight from the output tensors
+        ModelOutputs outputs;
+        outputs.boxes = outputTensors_[outputIndices_[0]].GetTensorRawData();
+        outputs.scores = outputTensors_[outputIndices_[1]].GetTensorRawData();
+        outputs.landmarks = outputTensors_[outputIndices_[2]].GetTensorRawData();
+        outputs.count = outputCount_;
+        outputs.halfPrecision = halfPrecisionOutputs_;
+        outputs.inputWidth = preprocessing_.width();
+        outputs.inputHeight = preprocessing_.height();
+        decodeOutputs(outputs, transform, deferLandmarks);
+    }
+
+    void FaceDetection::decodeOutputs(const ModelOutputs &outputs, const InputTransform &transform, bool deferLandmarks) {
+        // Face sizes are given in source pixels and checked in model input pixels
+        DetectionFilter filter = filter_;
+        filter.localMaxima = suppression_.mode == SuppressionMode::PEAKS;
+        filter.minFaceSize *= transform.scale;
+        filter.maxFaceSize *= transform.scale;
+        const size_t first = detections_.size();
+        postprocessing_.decode(outputs, filter, detections_, !deferLandmarks);
+        for (auto det = detections_.begin() + static_cast<std::ptrdiff_t>(first); det != detections_.end(); ++det) {
+            det->bounds = transform.toSource(det->bounds);
+            if (!deferLandmarks) {
+                landmarksToSource(*det, transform);
+            }
+        }
+        // Kept for decoding the landmarks of the faces that survive suppression
+        outputs_ = outputs;
+        transform_ = transform;
+        landmarksDeferred_ = deferLandmarks;
+    }
+
+    void FaceDetection::landmarksToSource(DetectionBox &det, const InputTransform &transform) {
+        // Mirrored input swaps the left and right landmarks (eyes, mouth corners) and
+        // flips the sign of yaw and roll; undo both so results read as unmirrored
+        static constexpr int MIRRORED_LANDMARKS[5] = {1, 0, 2, 4, 3};
+        const bool mirrored = transform.orientation.mirrored;
+        const std::array<Point, 5> landmarks = det.landmarks;
+        for (size_t j = 0; j < landmarks.size(); ++j) {
+            det.landmarks[j] = transform.toSource(landmarks[mirrored ? MIRRORED_LANDMARKS[j] : j]);
+        }
+        // Angles stay relative to the upright face
+        if (mirrored) {
+            det.angle.yaw = -det.angle.yaw;
+            det.angle.roll = -det.angle.roll;
+        }
+    }
+
+    void FaceDetection::setDetectionFilter(const DetectionFilter &filter) {
+        if (!(filter.scoreThreshold >= 0.0f && filter.scoreThreshold <= 1.0f)) {
+            throw std::invalid_argument("Score threshold must be between 0 and 1");
+        }
+        if (!(filter.minFaceSize >= 0.0f && filter.maxFaceSize >= filter.minFaceSize)) {
+            throw std::invalid_argument("Face size range must not be negative or empty");
+        }
+        filter_ = filter;
+    }
+
+    void FaceDetection::setSuppression(const SuppressionOptions &suppression) {
+        if (!(suppression.iouThreshold >= 0.0f && suppression.iouThreshold <= 1.0f)) {
+            throw std::invalid_argument("IoU threshold must be between 0 and 1");
+        }
+        if (!(suppression.sigma > 0.0f)) {
+            throw std::invalid_argument("Sigma must be positive");
+        }
+        suppression_ = suppression;
+    }
+
+    int FaceDetection::writeFaces(const int limit, float *buffer) {
+        // NMS; soft suppression also drops faces whose scores decay below the score threshold
+        SuppressionOptions suppression = suppression_;
+        suppression.minScore = filter_.scoreThreshold;
+        const std::vector<DetectionBox> &faces = nms_.select(detections_.data(), static_cast<int>(detections_.size()),
+                                                             suppression, limit);
+        int numFaces = std::min(static_cast<int>(faces.size()), limit);
+        // Fill the face buffer
         for (int i = 0; i < numFaces; ++i) {
-            const auto& det = detections[i];
+            DetectionBox det = faces[i];
+            if (landmarksDeferred_) {
+                postprocessing_.decodeLandmarks(outputs_, det);
+                landmarksToSource(det, transform_);
+            }
             buffer[0] = det.bounds.x;
             buffer[1] = det.bounds.y;
             buffer[2] = det.bounds.width;
@@ -116,19 +711,13 @@ namespace verid {
             buffer[4] = det.angle.yaw;
             buffer[5] = det.angle.pitch;
             buffer[6] = det.angle.roll;
-            buffer[7] = det.landmarks[0].x;
-            buffer[8] = det.landmarks[0].y;
-            buffer[9] = det.landmarks[1].x;
-            buffer[10] = det.landmarks[1].y;
-            buffer[11] = det.landmarks[2].x;
-            buffer[12] = det.landmarks[2].y;
-            buffer[13] = det.landmarks[3].x;
-            buffer[14] = det.landmarks[3].y;
-            buffer[15] = det.landmarks[4].x;
-            buffer[16] = det.landmarks[4].y;
+            for (int j = 0; j < 5; ++j) {
+                buffer[7 + j * 2] = det.landmarks[j].x;
+                buffer[8 + j * 2] = det.landmarks[j].y;
+            }
             buffer[17] = det.quality;
             buffer += 18;  // advance pointer by one face block
         }
         return numFaces;
     }
-} // verid
\ No newline at end of file
+} // verid
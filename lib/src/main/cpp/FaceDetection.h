@@ -5,38 +5,183 @@
 #ifndef FACE_DETECTION_FACEDETECTION_H
 #define FACE_DETECTION_FACEDETECTION_H
 
+#include <array>
 #include <string>
 #include <vector>
 #include <jni.h>
 #include <android/bitmap.h>
 #include <onnxruntime/core/session/onnxruntime_cxx_api.h>
+#include "NonMaxSuppression.h"
 #include "Postprocessing.h"
 #include "Preprocessing.h"
+#include "SharedEnvironment.h"
+#include "Tiling.h"
+#include "WorkerPool.h"
 
 namespace verid {
 
+    // Size the model runs at. Zero width and height select the model's default size. Models exported with
+    // dynamic height and width also run at other multiples of 32, e.g. 320x192 for a 16:9 frame.
+    struct InputSize {
+        int width = 0;
+        int height = 0;
+        // Fit the shorter side to the aspect ratio of the upright region, keeping the longer side
+        bool matchAspectRatio = false;
+    };
+
+    // Whole image of a batch, with the pixel layout taken by detectFaces
+    struct BatchImage {
+        void *data = nullptr;
+        int width = 0;
+        int height = 0;
+        int bytesPerRow = 0;
+        int format = 0;
+        Orientation orientation;
+    };
+
     class FaceDetection {
     public:
-        explicit FaceDetection(const std::string &modelPath, Ort::SessionOptions options);
+        // UINT8_NHWC prepends the input conversion to the model graph so preprocessing only writes bytes.
+        // FLOAT16_NCHW gives a half precision model fp16 inputs and outputs in place of float ones.
+        // QUANTIZED_NCHW feeds a QDQ model its input already quantized, skipping the leading QuantizeLinear.
+        // Models whose input already is uint8, fp16 or quantized are detected and fed that format regardless.
+        FaceDetection(const std::string &modelPath, Ort::SessionOptions options, int parallelism = 0,
+                      InputFormat inputFormat = InputFormat::FLOAT_NCHW);
         ~FaceDetection() = default;
+        // Faces in model input coordinates, requires a float input model
         int detectFaces(std::vector<float> &input, int limit, float *buffer);
-        int detectFaces(void *input, int width, int height, int bytesPerRow, int format, int limit, float *buffer);
+        // Faces in the given region of the image, detected upright in the given orientation
+        // and reported in image coordinates
+        int detectFaces(void *input, int width, int height, int bytesPerRow, int format, const Region &region,
+                        const Orientation &orientation, const InputSize &inputSize, int limit, float *buffer);
+        int detectFaces(const YuvImage &image, const Region &region, const Orientation &orientation,
+                        const InputSize &inputSize, int limit, float *buffer);
+        // Faces in each of the whole images at the default input size, upright in their orientations. Up to
+        // MAX_BATCH_SIZE images run through the model at once on a copy of it with a dynamic batch, or one
+        // by one if the model cannot take one. Faces of image i go to buffer + i * limit * 18 and their
+        // number to counts[i].
+        void detectFacesInBatch(const BatchImage *images, int count, int limit, float *buffer, int *counts);
+        // Faces in overlapping tiles at one or more scales, merged by non-max suppression in image coordinates
+        // Tiles run MAX_BATCH_SIZE at a time on the batch session, or one by one if the model cannot take a batch
+        int detectFacesInTiles(void *input, int width, int height, int bytesPerRow, int format,
+                               const Orientation &orientation, const TilingOptions &tiling, int limit, float *buffer);
+        static constexpr int MAX_BATCH_SIZE = 8;
+        [[nodiscard]] InputFormat inputFormat() const { return inputFormat_; }
+        [[nodiscard]] bool hasDynamicInputSize() const { return dynamicInputSize_; }
+        // Heap allocations made by the last detection outside the inference session itself,
+        // counted only when built with FACE_DETECTION_COUNT_ALLOCATIONS
+        [[nodiscard]] size_t detectionAllocations() const { return detectionAllocations_; }
+        // Environment the sessions run on, the same for every detector of the process
+        [[nodiscard]] const Ort::Env *environment() const { return env_.get(); }
+        // Resample plan cache lookups of all detections so far
+        [[nodiscard]] size_t planCacheHits() const { return preprocessing_.planCacheHits(); }
+        [[nodiscard]] size_t planCacheMisses() const { return preprocessing_.planCacheMisses(); }
+        // Minimum score and face size range of the detected faces, the sizes in source image pixels
+        void setDetectionFilter(const DetectionFilter &filter);
+        [[nodiscard]] const DetectionFilter &detectionFilter() const { return filter_; }
+        // Non-max suppression applied to the candidates of every detection call. Its minimum score is
+        // ignored: soft modes decay scores down to the detection filter's score threshold.
+        void setSuppression(const SuppressionOptions &suppression);
+        [[nodiscard]] const SuppressionOptions &suppression() const { return suppression_; }
     private:
-        Ort::Env env_;
+        // Shared with every other detector of the process, as are its thread pools
+        std::shared_ptr<Ort::Env> env_;
         Ort::Session session_;
         Ort::AllocatorWithDefaultOptions allocator_;
+        Ort::MemoryInfo memoryInfo_;
+        // Input and outputs bound once and rebound only when their tensors are recreated
+        Ort::IoBinding binding_;
+        Ort::RunOptions runOptions_;
+        bool inputBound_ = false;
+        // Model rewritten to a dynamic batch on the CPU, loaded by the first batch call
+        std::string modelPath_;
+        Ort::Session batchSession_{nullptr};
+        Ort::IoBinding batchBinding_{nullptr};
+        bool batchSessionLoaded_ = false;
+        std::vector<Ort::Value> batchOutputTensors_;
+        int batchOutputSize_ = 0;
+        // Batch input over the input buffer, recreated and rebound only when the batch size or the buffer changes
+        Ort::Value batchInput_{nullptr};
+        const void* batchInputData_ = nullptr;
+        int batchInputSize_ = 0;
 
         std::vector<const char*> inputNames_;
         std::vector<const char*> outputNames_;
+        InputFormat inputFormat_ = InputFormat::FLOAT_NCHW;
+        // Indices of the boxes, scores and landmarks outputs
+        std::array<size_t, 3> outputIndices_{};
+        bool halfPrecisionOutputs_ = false;
+        // Fixed size of the model input, or the default size of a model with dynamic height and width
+        int defaultInputWidth_;
+        int defaultInputHeight_;
+        bool dynamicInputSize_ = false;
 
+        WorkerPool workerPool_;
         Postprocessing postprocessing_;
         Preprocessing preprocessing_;
         std::vector<float> inputBuffer_;
-        std::vector<float> boxes_;
-        std::vector<float> scores_;
-        std::vector<float> landmarks_;
+        std::vector<unsigned char> byteInputBuffer_;
+        std::vector<uint16_t> halfInputBuffer_;
+        std::vector<int8_t> quantizedInputBuffer_;
+        bool signedQuantizedInput_ = false;
+        // Tensor over the input buffer, recreated only when the buffer or the input size changes
+        Ort::Value input_{nullptr};
+        const void* inputData_ = nullptr;
+        int inputWidth_ = 0;
+        int inputHeight_ = 0;
+        // Output tensors allocated once per input size and written in place by every run
+        std::vector<Ort::Value> outputTensors_;
+        int outputWidth_ = 0;
+        int outputHeight_ = 0;
+        int outputCount_ = 0;
+        // Detections of the current call; keeps its capacity across calls
+        std::vector<DetectionBox> detections_;
+        NonMaxSuppression nms_;
+        SuppressionOptions suppression_;
+        DetectionFilter filter_;
+        // Outputs and transform of the last run, whose landmarks are decoded after suppression
+        ModelOutputs outputs_;
+        InputTransform transform_;
+        bool landmarksDeferred_ = false;
+        size_t inferenceAllocations_ = 0;
+        size_t detectionAllocations_ = 0;
 
-        void loadModelIO();
+        // Loads the model from modelData, or from the path if it is empty
+        static Ort::Session createSession(const Ort::Env &env, const std::string &modelPath,
+                                          const std::vector<unsigned char> &modelData,
+                                          const Ort::SessionOptions &options, InputFormat inputFormat);
+        void loadModelIO(const std::string &modelPath);
+        // Calls the function with the input buffer matching the model's input format
+        template<typename Fn>
+        InputTransform preprocess(Fn &&preprocessInto);
+        // Sets the size the next input is preprocessed and run at
+        void selectInputSize(const InputSize &inputSize, const Region &region, const Orientation &orientation);
+        // Start of the input buffer matching the model's input format
+        [[nodiscard]] const void* inputData() const;
+        Ort::Value &inputTensor();
+        // Tensor over the input buffer holding batchSize images
+        Ort::Value createInputTensor(int batchSize);
+        // Boxes, scores and landmarks outputs for batchSize images, leaving the others empty
+        std::vector<Ort::Value> createOutputTensors(int batchSize);
+        void prepareOutputs();
+        // The batch session, or null if the model cannot take a dynamic batch
+        Ort::Session &batchSession();
+        // Runs the first batchSize images of the input buffer on the batch session
+        void runBatch(int batchSize);
+        // Outputs of one image of the last batch run
+        ModelOutputs batchOutputs(int slot);
+        // Appends detections before non-max suppression, in source image coordinates, to detections_.
+        // Deferred landmarks are decoded by writeFaces for the faces kept by suppression only.
+        void detect(Ort::Value &input, const InputTransform &transform, bool deferLandmarks);
+        // Decodes the outputs of one image as detect does after the run
+        void decodeOutputs(const ModelOutputs &outputs, const InputTransform &transform, bool deferLandmarks);
+        // Weighted suppression averages the landmarks of every box it merges
+        [[nodiscard]] bool deferLandmarks() const { return suppression_.mode != SuppressionMode::WEIGHTED; }
+        static void landmarksToSource(DetectionBox &det, const InputTransform &transform);
+        int writeFaces(int limit, float *buffer);
+        // Runs one detection call and records the allocations it made outside the session
+        template<typename Fn>
+        int countAllocations(Fn &&detectFrame);
     };
 
 } // verid
@@ -0,0 +1,67 @@
+#ifndef FACE_DETECTION_HALFFLOAT_H
+#define FACE_DETECTION_HALFFLOAT_H
+
+#include <cstdint>
+#include <cstring>
+
+namespace verid {
+
+    // IEEE 754 binary16 conversions, rounding to nearest even like the hardware instructions
+    inline uint16_t floatToHalf(float value) {
+        uint32_t f;
+        std::memcpy(&f, &value, sizeof(f));
+        const auto sign = static_cast<uint16_t>((f >> 16) & 0x8000);
+        f &= 0x7fffffff;
+        if (f >= 0x7f800000) {
+            // Infinity or NaN
+            return sign | 0x7c00 | (f > 0x7f800000 ? 0x200 : 0);
+        }
+        if (f >= 0x477ff000) {
+            // 65520 and above round to infinity
+            return sign | 0x7c00;
+        }
+        if (f < 0x38800000) {
+            // Subnormal half or zero
+            if (f < 0x33000000) return sign;
+            const uint32_t mantissa = (f & 0x7fffff) | 0x800000;
+            const uint32_t shift = 126 - (f >> 23);
+            uint32_t h = mantissa >> shift;
+            const uint32_t remainder = mantissa & ((1u << shift) - 1);
+            const uint32_t halfway = 1u << (shift - 1);
+            if (remainder > halfway || (remainder == halfway && (h & 1))) ++h;
+            return sign | static_cast<uint16_t>(h);
+        }
+        uint32_t h = (f >> 13) - (112 << 10);
+        const uint32_t remainder = f & 0x1fff;
+        if (remainder > 0x1000 || (remainder == 0x1000 && (h & 1))) ++h;
+        return sign | static_cast<uint16_t>(h);
+    }
+
+    inline float halfToFloat(uint16_t h) {
+        const uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+        uint32_t exponent = (h >> 10) & 0x1f;
+        uint32_t mantissa = h & 0x3ff;
+        uint32_t f;
+        if (exponent == 0x1f) {
+            f = sign | 0x7f800000 | (mantissa << 13);
+        } else if (exponent != 0) {
+            f = sign | ((exponent + 112) << 23) | (mantissa << 13);
+        } else if (mantissa == 0) {
+            f = sign;
+        } else {
+            // Subnormal half is a normal float
+            exponent = 113;
+            while (!(mantissa & 0x400)) {
+                mantissa <<= 1;
+                --exponent;
+            }
+            f = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+        }
+        float value;
+        std::memcpy(&value, &f, sizeof(value));
+        return value;
+    }
+
+}
+
+#endif //FACE_DETECTION_HALFFLOAT_H
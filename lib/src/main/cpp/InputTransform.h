@@ -0,0 +1,58 @@
+#ifndef FACE_DETECTION_INPUTTRANSFORM_H
+#define FACE_DETECTION_INPUTTRANSFORM_H
+
+#include <algorithm>
+#include "Postprocessing.h"
+
+namespace verid {
+
+    // Rectangle in source image pixels
+    struct Region {
+        int x = 0;
+        int y = 0;
+        int width = 0;
+        int height = 0;
+    };
+
+    // Clockwise rotation (0, 90, 180 or 270 degrees) that makes the image upright,
+    // followed by an optional horizontal flip, e.g. for front camera frames
+    struct Orientation {
+        int rotation = 0;
+        bool mirrored = false;
+    };
+
+    // Maps coordinates in the model input back to the source image
+    struct InputTransform {
+        float scale = 1.0f;
+        // Region of the source image the model input was sampled from
+        float originX = 0.0f;
+        float originY = 0.0f;
+        float regionWidth = 0.0f;
+        float regionHeight = 0.0f;
+        Orientation orientation;
+
+        [[nodiscard]] Point toSource(const Point& p) const {
+            const bool swapAxes = orientation.rotation == 90 || orientation.rotation == 270;
+            float u = p.x / scale;
+            float v = p.y / scale;
+            if (orientation.mirrored) u = (swapAxes ? regionHeight : regionWidth) - u;
+            switch (orientation.rotation) {
+                case 90: return { originX + v, originY + regionHeight - u };
+                case 180: return { originX + regionWidth - u, originY + regionHeight - v };
+                case 270: return { originX + regionWidth - v, originY + u };
+                default: return { originX + u, originY + v };
+            }
+        }
+
+        [[nodiscard]] Rect toSource(const Rect& r) const {
+            const Point a = toSource(Point{ r.x, r.y });
+            const Point b = toSource(Point{ r.x + r.width, r.y + r.height });
+            const float x = std::min(a.x, b.x);
+            const float y = std::min(a.y, b.y);
+            return { x, y, std::max(a.x, b.x) - x, std::max(a.y, b.y) - y };
+        }
+    };
+
+}
+
+#endif //FACE_DETECTION_INPUTTRANSFORM_H
@@ -0,0 +1,466 @@
+#include "ModelReader.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+#include "Logger.h"
+
+namespace verid {
+
+    namespace {
+        // ONNX protobuf field numbers
+        constexpr uint32_t MODEL_GRAPH = 7;
+        constexpr uint32_t GRAPH_NODE = 1;
+        constexpr uint32_t GRAPH_INITIALIZER = 5;
+        constexpr uint32_t GRAPH_INPUT = 11;
+        constexpr uint32_t GRAPH_OUTPUT = 12;
+        constexpr uint32_t GRAPH_VALUE_INFO = 13;
+        constexpr uint32_t NODE_INPUT = 1;
+        constexpr uint32_t NODE_OUTPUT = 2;
+        constexpr uint32_t NODE_OP_TYPE = 4;
+        constexpr uint32_t NODE_ATTRIBUTE = 5;
+        constexpr uint32_t ATTRIBUTE_NAME = 1;
+        constexpr uint32_t ATTRIBUTE_INT = 3;
+        constexpr uint32_t ATTRIBUTE_TENSOR = 5;
+        constexpr uint32_t VALUE_INFO_TYPE = 2;
+        constexpr uint32_t TYPE_TENSOR = 1;
+        constexpr uint32_t TENSOR_TYPE_SHAPE = 2;
+        constexpr uint32_t SHAPE_DIM = 1;
+        constexpr uint32_t DIM_VALUE = 1;
+        constexpr uint32_t DIM_PARAM = 2;
+        constexpr uint32_t TENSOR_DATA_TYPE = 2;
+        constexpr uint32_t TENSOR_FLOAT_DATA = 4;
+        constexpr uint32_t TENSOR_INT32_DATA = 5;
+        constexpr uint32_t TENSOR_INT64_DATA = 7;
+        constexpr uint32_t TENSOR_NAME = 8;
+        constexpr uint32_t TENSOR_RAW_DATA = 9;
+        // TensorProto data types
+        constexpr uint64_t DATA_TYPE_FLOAT = 1;
+        constexpr uint64_t DATA_TYPE_UINT8 = 2;
+        constexpr uint64_t DATA_TYPE_INT8 = 3;
+        constexpr uint64_t DATA_TYPE_INT64 = 7;
+        // Name of the dynamic batch dimension
+        const std::string BATCH_DIM = "batch";
+
+        enum WireType : uint32_t { VARINT = 0, FIXED64 = 1, LENGTH_DELIMITED = 2, FIXED32 = 5 };
+
+        struct Field {
+            uint32_t number;
+            uint32_t wireType;
+            uint64_t value;
+            const unsigned char* data;
+            size_t size;
+        };
+
+        // Sequential reader over the fields of one protobuf message
+        class MessageReader {
+        public:
+            MessageReader(const unsigned char* data, size_t size) : p_(data), end_(data + size) {}
+
+            bool next(Field& field) {
+                if (p_ >= end_) return false;
+                const uint64_t key = varint();
+                field.number = static_cast<uint32_t>(key >> 3);
+                field.wireType = static_cast<uint32_t>(key & 7);
+                field.value = 0;
+                field.data = nullptr;
+                field.size = 0;
+                switch (field.wireType) {
+                    case VARINT:
+                        field.value = varint();
+                        break;
+                    case FIXED64:
+                        field.data = take(8);
+                        field.size = 8;
+                        break;
+                    case LENGTH_DELIMITED:
+                        field.size = static_cast<size_t>(varint());
+                        field.data = take(field.size);
+                        break;
+                    case FIXED32:
+                        field.data = take(4);
+                        field.size = 4;
+                        break;
+                    default:
+                        throw std::runtime_error("Malformed model file");
+                }
+                return true;
+            }
+
+            [[nodiscard]] bool atEnd() const { return p_ >= end_; }
+
+            uint64_t varint() {
+                uint64_t result = 0;
+                for (int shift = 0; shift < 64; shift += 7) {
+                    if (p_ >= end_) break;
+                    const unsigned char byte = *p_++;
+                    result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                    if (!(byte & 0x80)) return result;
+                }
+                throw std::runtime_error("Malformed model file");
+            }
+
+        private:
+            const unsigned char* p_;
+            const unsigned char* end_;
+
+            const unsigned char* take(size_t size) {
+                if (static_cast<size_t>(end_ - p_) < size) throw std::runtime_error("Malformed model file");
+                const unsigned char* start = p_;
+                p_ += size;
+                return start;
+            }
+        };
+
+        std::string toString(const Field& field) {
+            return {reinterpret_cast<const char*>(field.data), field.size};
+        }
+
+        std::vector<unsigned char> readFile(const std::string& path) {
+            std::ifstream file(path, std::ios::binary);
+            if (!file) throw std::runtime_error("Cannot open model file");
+            return {std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+        }
+
+        void writeVarint(std::vector<unsigned char>& out, uint64_t value) {
+            while (value >= 0x80) {
+                out.push_back(static_cast<unsigned char>(value | 0x80));
+                value >>= 7;
+            }
+            out.push_back(static_cast<unsigned char>(value));
+        }
+
+        void writeKey(std::vector<unsigned char>& out, uint32_t number, uint32_t wireType) {
+            writeVarint(out, static_cast<uint64_t>(number) << 3 | wireType);
+        }
+
+        void writeBytes(std::vector<unsigned char>& out, uint32_t number, const unsigned char* data, size_t size) {
+            writeKey(out, number, LENGTH_DELIMITED);
+            writeVarint(out, size);
+            out.insert(out.end(), data, data + size);
+        }
+
+        void writeField(std::vector<unsigned char>& out, const Field& field) {
+            if (field.wireType == LENGTH_DELIMITED) {
+                writeBytes(out, field.number, field.data, field.size);
+                return;
+            }
+            writeKey(out, field.number, field.wireType);
+            if (field.wireType == VARINT) {
+                writeVarint(out, field.value);
+            } else {
+                out.insert(out.end(), field.data, field.data + field.size);
+            }
+        }
+
+        // Copies a message, letting rewrite replace fields by writing something else, or nothing, and returning true
+        template<typename Fn>
+        std::vector<unsigned char> rewriteMessage(const unsigned char* data, size_t size, Fn&& rewrite) {
+            std::vector<unsigned char> out;
+            out.reserve(size);
+            MessageReader reader(data, size);
+            Field field{};
+            while (reader.next(field)) {
+                if (!rewrite(field, out)) writeField(out, field);
+            }
+            return out;
+        }
+
+        template<typename Fn>
+        bool rewriteNested(const Field& field, uint32_t number, std::vector<unsigned char>& out, Fn&& rewrite) {
+            if (field.number != number || field.wireType != LENGTH_DELIMITED) return false;
+            const std::vector<unsigned char> message = rewriteMessage(field.data, field.size, rewrite);
+            writeBytes(out, number, message.data(), message.size());
+            return true;
+        }
+
+        // Makes the first dimension of a graph input or output symbolic. Returns its fixed size or 0.
+        int64_t makeBatchDynamic(const Field& valueInfo, std::vector<unsigned char>& out) {
+            int64_t batch = 0;
+            rewriteNested(valueInfo, valueInfo.number, out, [&](const Field& info, auto& infoOut) {
+                return rewriteNested(info, VALUE_INFO_TYPE, infoOut, [&](const Field& type, auto& typeOut) {
+                    return rewriteNested(type, TYPE_TENSOR, typeOut, [&](const Field& tensor, auto& tensorOut) {
+                        bool first = true;
+                        return rewriteNested(tensor, TENSOR_TYPE_SHAPE, tensorOut, [&](const Field& dim, auto& shapeOut) {
+                            if (dim.number != SHAPE_DIM || !first) return false;
+                            first = false;
+                            MessageReader reader(dim.data, dim.size);
+                            Field value{};
+                            while (reader.next(value)) {
+                                if (value.number == DIM_VALUE) batch = static_cast<int64_t>(value.value);
+                            }
+                            if (batch != 1) return false;
+                            std::vector<unsigned char> symbolic;
+                            writeBytes(symbolic, DIM_PARAM, reinterpret_cast<const unsigned char*>(BATCH_DIM.data()), BATCH_DIM.size());
+                            writeBytes(shapeOut, SHAPE_DIM, symbolic.data(), symbolic.size());
+                            return true;
+                        });
+                    });
+                });
+            });
+            return batch;
+        }
+
+        // Shape tensor of a reshape to a fixed batch of 1 and an inferred dimension, e.g. (1, -1, 4),
+        // with its batch changed to 0, which keeps the batch of the reshaped tensor
+        bool keepBatchOfReshape(const unsigned char* data, size_t size, std::vector<unsigned char>& tensorOut) {
+            uint64_t dataType = 0;
+            std::vector<int64_t> values;
+            MessageReader reader(data, size);
+            Field field{};
+            while (reader.next(field)) {
+                if (field.number == TENSOR_DATA_TYPE) {
+                    dataType = field.value;
+                } else if (field.number == TENSOR_RAW_DATA) {
+                    values.resize(field.size / sizeof(int64_t));
+                    std::memcpy(values.data(), field.data, values.size() * sizeof(int64_t));
+                } else if (field.number == TENSOR_INT64_DATA) {
+                    if (field.wireType == LENGTH_DELIMITED) {
+                        MessageReader packed(field.data, field.size);
+                        while (!packed.atEnd()) values.push_back(static_cast<int64_t>(packed.varint()));
+                    } else {
+                        values.push_back(static_cast<int64_t>(field.value));
+                    }
+                }
+            }
+            if (dataType != DATA_TYPE_INT64 || values.size() < 2 || values[0] != 1 ||
+                std::find(values.begin() + 1, values.end(), -1) == values.end()) {
+                return false;
+            }
+            values[0] = 0;
+            tensorOut = rewriteMessage(data, size, [&](const Field& tensorField, std::vector<unsigned char>& out) {
+                if (tensorField.number == TENSOR_RAW_DATA) {
+                    writeBytes(out, TENSOR_RAW_DATA, reinterpret_cast<const unsigned char*>(values.data()),
+                               values.size() * sizeof(int64_t));
+                    return true;
+                }
+                if (tensorField.number == TENSOR_INT64_DATA) {
+                    // Values are written once, packed, in place of the first
+                    if (values.empty()) return true;
+                    std::vector<unsigned char> packed;
+                    for (int64_t v : values) writeVarint(packed, static_cast<uint64_t>(v));
+                    writeBytes(out, TENSOR_INT64_DATA, packed.data(), packed.size());
+                    values.clear();
+                    return true;
+                }
+                return false;
+            });
+            return true;
+        }
+
+        struct Scalar {
+            uint64_t dataType = 0;
+            double value = 0;
+            bool found = false;
+        };
+
+        // Single element initializer in any of the encodings the exporters use
+        Scalar readScalar(const unsigned char* data, size_t size) {
+            Scalar scalar;
+            MessageReader tensor(data, size);
+            Field field{};
+            while (tensor.next(field)) {
+                if (field.number == TENSOR_DATA_TYPE) {
+                    scalar.dataType = field.value;
+                } else if (field.number == TENSOR_RAW_DATA && field.size > 0) {
+                    if (field.size >= 4 && scalar.dataType == DATA_TYPE_FLOAT) {
+                        float f;
+                        std::memcpy(&f, field.data, sizeof(f));
+                        scalar.value = f;
+                    } else {
+                        scalar.value = scalar.dataType == DATA_TYPE_INT8
+                                ? static_cast<double>(static_cast<int8_t>(field.data[0]))
+                                : static_cast<double>(field.data[0]);
+                    }
+                    scalar.found = true;
+                } else if (field.number == TENSOR_FLOAT_DATA && field.size >= 4) {
+                    float f;
+                    std::memcpy(&f, field.data, sizeof(f));
+                    scalar.value = f;
+                    scalar.found = true;
+                } else if (field.number == TENSOR_INT32_DATA) {
+                    uint64_t v = field.value;
+                    if (field.wireType == LENGTH_DELIMITED) {
+                        MessageReader packed(field.data, field.size);
+                        v = packed.varint();
+                    }
+                    scalar.value = static_cast<int32_t>(static_cast<uint32_t>(v));
+                    scalar.found = true;
+                }
+            }
+            // The raw data of the zero point may precede its data type
+            if (scalar.found && scalar.dataType == DATA_TYPE_INT8 && scalar.value > 127) {
+                scalar.value -= 256;
+            }
+            return scalar;
+        }
+    }
+
+    InputQuantization readInputQuantization(const std::string& modelPath, const std::string& inputName) {
+        const std::vector<unsigned char> model = readFile(modelPath);
+
+        const unsigned char* graphData = nullptr;
+        size_t graphSize = 0;
+        MessageReader modelReader(model.data(), model.size());
+        Field field{};
+        while (modelReader.next(field)) {
+            if (field.number == MODEL_GRAPH && field.wireType == LENGTH_DELIMITED) {
+                graphData = field.data;
+                graphSize = field.size;
+            }
+        }
+        if (!graphData) throw std::runtime_error("Model file has no graph");
+
+        // Find the (de)quantization node fed by the input
+        std::string scaleName, zeroPointName;
+        MessageReader graph(graphData, graphSize);
+        while (graph.next(field)) {
+            if (field.number != GRAPH_NODE) continue;
+            MessageReader node(field.data, field.size);
+            Field nodeField{};
+            std::vector<std::string> inputs;
+            std::string opType;
+            while (node.next(nodeField)) {
+                if (nodeField.number == NODE_INPUT) inputs.push_back(toString(nodeField));
+                else if (nodeField.number == NODE_OP_TYPE) opType = toString(nodeField);
+            }
+            if ((opType == "QuantizeLinear" || opType == "DequantizeLinear") && inputs.size() == 3 && inputs[0] == inputName) {
+                scaleName = inputs[1];
+                zeroPointName = inputs[2];
+                break;
+            }
+        }
+        if (scaleName.empty()) {
+            throw std::runtime_error("Model input is not quantized");
+        }
+
+        Scalar scale, zeroPoint;
+        MessageReader initializers(graphData, graphSize);
+        while (initializers.next(field)) {
+            if (field.number != GRAPH_INITIALIZER) continue;
+            MessageReader tensor(field.data, field.size);
+            Field tensorField{};
+            std::string name;
+            while (tensor.next(tensorField)) {
+                if (tensorField.number == TENSOR_NAME) name = toString(tensorField);
+            }
+            if (name == scaleName) scale = readScalar(field.data, field.size);
+            else if (name == zeroPointName) zeroPoint = readScalar(field.data, field.size);
+        }
+        if (!scale.found || scale.dataType != DATA_TYPE_FLOAT || scale.value <= 0) {
+            throw std::runtime_error("Unsupported input quantization scale");
+        }
+        if (zeroPoint.dataType != DATA_TYPE_INT8 && zeroPoint.dataType != DATA_TYPE_UINT8) {
+            throw std::runtime_error("Unsupported input quantization type");
+        }
+        InputQuantization quantization;
+        quantization.scale = static_cast<float>(scale.value);
+        // A zero point without data is zero
+        quantization.zeroPoint = static_cast<int>(zeroPoint.value);
+        quantization.isSigned = zeroPoint.dataType == DATA_TYPE_INT8;
+        return quantization;
+    }
+
+    std::vector<unsigned char> readModelWithDynamicBatch(const std::string& modelPath) {
+        const std::vector<unsigned char> model = readFile(modelPath);
+        return rewriteMessage(model.data(), model.size(), [&](const Field& modelField, std::vector<unsigned char>& modelOut) {
+            if (modelField.number != MODEL_GRAPH || modelField.wireType != LENGTH_DELIMITED) return false;
+            // Shape inputs of the reshapes that may pin the batch
+            std::vector<std::string> shapeNames;
+            MessageReader graph(modelField.data, modelField.size);
+            Field field{};
+            while (graph.next(field)) {
+                if (field.number != GRAPH_NODE) continue;
+                MessageReader node(field.data, field.size);
+                Field nodeField{};
+                std::vector<std::string> inputs;
+                std::string opType;
+                bool allowZero = false;
+                while (node.next(nodeField)) {
+                    if (nodeField.number == NODE_INPUT) {
+                        inputs.push_back(toString(nodeField));
+                    } else if (nodeField.number == NODE_OP_TYPE) {
+                        opType = toString(nodeField);
+                    } else if (nodeField.number == NODE_ATTRIBUTE) {
+                        MessageReader attribute(nodeField.data, nodeField.size);
+                        Field attributeField{};
+                        std::string name;
+                        uint64_t value = 0;
+                        while (attribute.next(attributeField)) {
+                            if (attributeField.number == ATTRIBUTE_NAME) name = toString(attributeField);
+                            else if (attributeField.number == ATTRIBUTE_INT) value = attributeField.value;
+                        }
+                        allowZero = allowZero || (name == "allowzero" && value != 0);
+                    }
+                }
+                // A zero in the shape of an allowzero reshape is a size, not a copied dimension
+                if (opType == "Reshape" && inputs.size() == 2 && !allowZero) shapeNames.push_back(inputs[1]);
+            }
+            auto isShape = [&](const std::string& name) {
+                return std::find(shapeNames.begin(), shapeNames.end(), name) != shapeNames.end();
+            };
+
+            bool inputRewritten = false;
+            const std::vector<unsigned char> rewritten = rewriteMessage(modelField.data, modelField.size,
+                    [&](const Field& graphField, std::vector<unsigned char>& graphOut) {
+                switch (graphField.number) {
+                    case GRAPH_INPUT: {
+                        const int64_t batch = makeBatchDynamic(graphField, graphOut);
+                        if (batch > 1) throw std::runtime_error("Model has a fixed batch size");
+                        inputRewritten = inputRewritten || batch == 1;
+                        return true;
+                    }
+                    case GRAPH_OUTPUT:
+                        makeBatchDynamic(graphField, graphOut);
+                        return true;
+                    case GRAPH_VALUE_INFO:
+                        return true;
+                    case GRAPH_INITIALIZER: {
+                        MessageReader tensor(graphField.data, graphField.size);
+                        Field tensorField{};
+                        std::string name;
+                        while (tensor.next(tensorField)) {
+                            if (tensorField.number == TENSOR_NAME) name = toString(tensorField);
+                        }
+                        std::vector<unsigned char> shape;
+                        if (!isShape(name) || !keepBatchOfReshape(graphField.data, graphField.size, shape)) return false;
+                        writeBytes(graphOut, GRAPH_INITIALIZER, shape.data(), shape.size());
+                        return true;
+                    }
+                    case GRAPH_NODE: {
+                        // Shapes held by Constant nodes
+                        MessageReader node(graphField.data, graphField.size);
+                        Field nodeField{};
+                        bool constantShape = false;
+                        std::string opType;
+                        while (node.next(nodeField)) {
+                            if (nodeField.number == NODE_OUTPUT) constantShape = constantShape || isShape(toString(nodeField));
+                            else if (nodeField.number == NODE_OP_TYPE) opType = toString(nodeField);
+                        }
+                        if (opType != "Constant" || !constantShape) return false;
+                        return rewriteNested(graphField, GRAPH_NODE, graphOut, [&](const Field& nodeField, auto& nodeOut) {
+                            return rewriteNested(nodeField, NODE_ATTRIBUTE, nodeOut, [&](const Field& attribute, auto& attributeOut) {
+                                std::vector<unsigned char> shape;
+                                if (attribute.number != ATTRIBUTE_TENSOR ||
+                                    !keepBatchOfReshape(attribute.data, attribute.size, shape)) return false;
+                                writeBytes(attributeOut, ATTRIBUTE_TENSOR, shape.data(), shape.size());
+                                return true;
+                            });
+                        });
+                    }
+                    default:
+                        return false;
+                }
+            });
+            if (!inputRewritten) {
+                LOGI("Model input already has a dynamic batch");
+            }
+            writeBytes(modelOut, MODEL_GRAPH, rewritten.data(), rewritten.size());
+            return true;
+        });
+    }
+
+}
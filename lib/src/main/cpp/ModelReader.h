@@ -0,0 +1,28 @@
+#ifndef FACE_DETECTION_MODELREADER_H
+#define FACE_DETECTION_MODELREADER_H
+
+#include <string>
+#include <vector>
+
+namespace verid {
+
+    // Quantization of a model input, q = saturate(round(x / scale) + zeroPoint)
+    struct InputQuantization {
+        float scale = 1.0f;
+        int zeroPoint = 0;
+        // int8 rather than uint8
+        bool isSigned = false;
+    };
+
+    // Reads the quantization of the given input straight from the ONNX file, which the runtime
+    // does not expose. Throws unless the input feeds a QuantizeLinear or DequantizeLinear node.
+    InputQuantization readInputQuantization(const std::string& modelPath, const std::string& inputName);
+
+    // The ONNX file with a dynamic batch dimension. Inputs and outputs with a batch of 1 get a symbolic
+    // batch, reshapes to a batch of 1 keep the batch of their input and the value infos of intermediate
+    // tensors, which the runtime infers again, are left out. Throws if the input has another fixed batch.
+    std::vector<unsigned char> readModelWithDynamicBatch(const std::string& modelPath);
+
+}
+
+#endif //FACE_DETECTION_MODELREADER_H
@@ -0,0 +1,537 @@
+#include "NonMaxSuppression.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <random>
+#include "Logger.h"
+
+namespace verid {
+
+    namespace {
+        // Below these numbers of candidates or of boxes that can be kept, checking every box of
+        // interest with the SIMD kernel is faster than the grid
+        constexpr int GRID_MIN_CANDIDATES = 512;
+        constexpr int GRID_MIN_KEPT = 32;
+        // Grid cells per side at most
+        constexpr float MAX_GRID_CELLS = 64;
+        // Kept box planes are padded to a multiple of this many floats
+        constexpr size_t PLANE_ALIGNMENT = 16;
+
+        inline BoxCorners cornersOf(const Rect& rect) {
+            return {rect.x, rect.y, rect.x + rect.width, rect.y + rect.height, rect.width * rect.height};
+        }
+
+        // Bits of the float that order as unsigned integers like the floats do
+        inline uint32_t orderedBits(float value) {
+            uint32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            return bits & 0x80000000u ? ~bits : bits | 0x80000000u;
+        }
+
+        // Max-heap order of (score, slot): higher scores first, ties to the lower slot
+        inline bool heapOrder(const std::pair<float, int>& a, const std::pair<float, int>& b) {
+            return a.first < b.first || (a.first == b.first && a.second > b.second);
+        }
+
+        // Clamped cell of the coordinate; NaN lands in the first cell
+        inline int cellOf(float value, float origin, float cellSize, int cells) {
+            const float cell = (value - origin) / cellSize;
+            if (!(cell > 0.0f)) return 0;
+            if (cell >= static_cast<float>(cells)) return cells - 1;
+            return static_cast<int>(cell);
+        }
+    }
+
+    NonMaxSuppression::NonMaxSuppression(int topK) : topK(topK), kernel(selectedPostprocessingKernel()) {}
+
+    const std::vector<DetectionBox>& NonMaxSuppression::select(const DetectionBox* boxes, int count,
+                                                               const SuppressionOptions& options, int limit) {
+        selected.clear();
+        results.clear();
+        if (count <= 0 || limit <= 0) return results;
+        // Scores and indices packed into keys that sort ascending best first, ties to the lower
+        // index, without reaching back into the detections
+        keys.resize(count);
+        for (int i = 0; i < count; ++i) {
+            keys[i] = static_cast<uint64_t>(~orderedBits(boxes[i].score)) << 32 | static_cast<uint32_t>(i);
+        }
+        int sortedCount = count;
+        if (topK > 0 && count > topK) {
+            std::nth_element(keys.begin(), keys.begin() + topK, keys.end());
+            sortedCount = topK;
+        }
+        std::sort(keys.begin(), keys.begin() + sortedCount);
+        order.resize(sortedCount);
+        for (int n = 0; n < sortedCount; ++n) {
+            order[n] = static_cast<int>(keys[n] & 0xFFFFFFFFu);
+        }
+        if (options.mode == SuppressionMode::LINEAR || options.mode == SuppressionMode::GAUSSIAN) {
+            selectSoft(boxes, sortedCount, options, limit);
+            return results;
+        }
+        if (options.mode == SuppressionMode::WEIGHTED) {
+            selectWeighted(boxes, sortedCount, options.iouThreshold, limit);
+            return results;
+        }
+
+        const int capacity = std::min(limit, sortedCount);
+        keptStride = (static_cast<size_t>(capacity) + PLANE_ALIGNMENT - 1) / PLANE_ALIGNMENT * PLANE_ALIGNMENT;
+        if (keptPlanes.size() < 5 * keptStride) keptPlanes.resize(5 * keptStride);
+        if (iou.size() < keptStride) iou.resize(keptStride);
+        if (options.iouThreshold > 0.0f && sortedCount >= GRID_MIN_CANDIDATES && capacity >= GRID_MIN_KEPT &&
+            layGrid(boxes, sortedCount)) {
+            selectInGrid(boxes, sortedCount, options.iouThreshold, limit);
+        } else {
+            selectAll(boxes, sortedCount, options.iouThreshold, limit);
+        }
+        for (int index : selected) {
+            results.push_back(boxes[index]);
+        }
+        return results;
+    }
+
+    BoxPlanes NonMaxSuppression::keptBoxes() const {
+        const float* planes = keptPlanes.data();
+        return {planes, planes + keptStride, planes + 2 * keptStride, planes + 3 * keptStride, planes + 4 * keptStride};
+    }
+
+    void NonMaxSuppression::keep(const BoxCorners& box, int keptCount) {
+        float* planes = keptPlanes.data() + keptCount;
+        planes[0] = box.x1;
+        planes[keptStride] = box.y1;
+        planes[2 * keptStride] = box.x2;
+        planes[3 * keptStride] = box.y2;
+        planes[4 * keptStride] = box.area;
+    }
+
+    void NonMaxSuppression::selectAll(const DetectionBox* boxes, int count, float iouThreshold, int limit) {
+        for (int n = 0; n < count && static_cast<int>(selected.size()) < limit; ++n) {
+            const int index = order[n];
+            const BoxCorners box = cornersOf(boxes[index].bounds);
+            const int keptCount = static_cast<int>(selected.size());
+            kernel.iouRow(keptBoxes(), keptCount, box, iou.data());
+            if (std::none_of(iou.begin(), iou.begin() + keptCount, [&](float value) { return value >= iouThreshold; })) {
+                keep(box, keptCount);
+                selected.push_back(index);
+            }
+        }
+    }
+
+    void NonMaxSuppression::selectInGrid(const DetectionBox* boxes, int count, float iouThreshold, int limit) {
+        // Boxes overlapping by a positive IoU share at least one cell, so each candidate is only
+        // checked against the kept boxes of the cells it covers
+        const BoxPlanes planes = keptBoxes();
+        for (int n = 0; n < count && static_cast<int>(selected.size()) < limit; ++n) {
+            const int index = order[n];
+            const BoxCorners box = cornersOf(boxes[index].bounds);
+            const CellRange cells = cellsOf(box);
+            bool suppressed = false;
+            for (int row = cells.row0; row <= cells.row1 && !suppressed; ++row) {
+                for (int column = cells.column0; column <= cells.column1 && !suppressed; ++column) {
+                    for (int entry = cellHeads[row * grid.columns + column]; entry >= 0; entry = entryNext[entry]) {
+                        const int k = entryItem[entry];
+                        const BoxCorners other{planes.x1[k], planes.y1[k], planes.x2[k], planes.y2[k], planes.area[k]};
+                        if (cornersIou(other, box) >= iouThreshold) {
+                            suppressed = true;
+                            break;
+                        }
+                    }
+                }
+            }
+            if (suppressed) continue;
+            const int keptCount = static_cast<int>(selected.size());
+            keep(box, keptCount);
+            selected.push_back(index);
+            addToGrid(cells, keptCount);
+        }
+    }
+
+    bool NonMaxSuppression::layGrid(const DetectionBox* boxes, int count) {
+        float minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY;
+        float sideSum = 0.0f;
+        for (int n = 0; n < count; ++n) {
+            const Rect& rect = boxes[order[n]].bounds;
+            minX = std::min(minX, rect.x);
+            minY = std::min(minY, rect.y);
+            maxX = std::max(maxX, rect.x + rect.width);
+            maxY = std::max(maxY, rect.y + rect.height);
+            sideSum += std::max(rect.width, rect.height);
+        }
+        const float side = sideSum / static_cast<float>(count);
+        if (!std::isfinite(maxX - minX) || !std::isfinite(maxY - minY) || !std::isfinite(side) || !(side > 0.0f)) {
+            return false;
+        }
+        grid.originX = minX;
+        grid.originY = minY;
+        grid.columns = static_cast<int>(std::clamp(std::ceil((maxX - minX) / side), 1.0f, MAX_GRID_CELLS));
+        grid.rows = static_cast<int>(std::clamp(std::ceil((maxY - minY) / side), 1.0f, MAX_GRID_CELLS));
+        grid.cellWidth = std::max((maxX - minX) / static_cast<float>(grid.columns), side);
+        grid.cellHeight = std::max((maxY - minY) / static_cast<float>(grid.rows), side);
+        cellHeads.assign(static_cast<size_t>(grid.columns) * grid.rows, -1);
+        entryNext.clear();
+        entryItem.clear();
+        return true;
+    }
+
+    NonMaxSuppression::CellRange NonMaxSuppression::cellsOf(const BoxCorners& box) const {
+        return {cellOf(box.x1, grid.originX, grid.cellWidth, grid.columns),
+                cellOf(box.x2, grid.originX, grid.cellWidth, grid.columns),
+                cellOf(box.y1, grid.originY, grid.cellHeight, grid.rows),
+                cellOf(box.y2, grid.originY, grid.cellHeight, grid.rows)};
+    }
+
+    void NonMaxSuppression::addToGrid(const CellRange& cells, int item) {
+        for (int row = cells.row0; row <= cells.row1; ++row) {
+            for (int column = cells.column0; column <= cells.column1; ++column) {
+                int& head = cellHeads[row * grid.columns + column];
+                entryItem.push_back(item);
+                entryNext.push_back(head);
+                head = static_cast<int>(entryNext.size()) - 1;
+            }
+        }
+    }
+
+    void NonMaxSuppression::prepareCandidates(const DetectionBox* boxes, int count) {
+        candidateCount = count;
+        candidateStride = (static_cast<size_t>(count) + PLANE_ALIGNMENT - 1) / PLANE_ALIGNMENT * PLANE_ALIGNMENT;
+        if (candidatePlanes.size() < 5 * candidateStride) candidatePlanes.resize(5 * candidateStride);
+        if (iou.size() < candidateStride) iou.resize(candidateStride);
+        scores.resize(count);
+        candidates.resize(count);
+        for (int n = 0; n < count; ++n) {
+            const BoxCorners box = cornersOf(boxes[order[n]].bounds);
+            float* planes = candidatePlanes.data() + n;
+            planes[0] = box.x1;
+            planes[candidateStride] = box.y1;
+            planes[2 * candidateStride] = box.x2;
+            planes[3 * candidateStride] = box.y2;
+            planes[4 * candidateStride] = box.area;
+            scores[n] = boxes[order[n]].score;
+            candidates[n] = order[n];
+        }
+        cursor = 0;
+        decayed.assign(count, 0);
+        heap.clear();
+        useGrid = count >= GRID_MIN_CANDIDATES && layGrid(boxes, count);
+        if (useGrid) {
+            for (int n = 0; n < count; ++n) {
+                addToGrid(cellsOf(cornersOf(boxes[order[n]].bounds)), n);
+            }
+            visits.assign(count, 0);
+            visit = 0;
+        }
+    }
+
+    BoxPlanes NonMaxSuppression::candidateBoxes() const {
+        const float* planes = candidatePlanes.data();
+        return {planes, planes + candidateStride, planes + 2 * candidateStride, planes + 3 * candidateStride,
+                planes + 4 * candidateStride};
+    }
+
+    int NonMaxSuppression::nextBest() {
+        while (cursor < candidateCount && (decayed[cursor] || scores[cursor] == -INFINITY)) ++cursor;
+        // Entries whose candidate has since decayed further, been taken or dropped are stale
+        while (!heap.empty() && scores[heap.front().second] != heap.front().first) {
+            std::pop_heap(heap.begin(), heap.end(), heapOrder);
+            heap.pop_back();
+        }
+        if (heap.empty()) return cursor < candidateCount ? cursor : -1;
+        const auto [score, slot] = heap.front();
+        if (cursor < candidateCount && (scores[cursor] > score || (scores[cursor] == score && cursor < slot))) {
+            return cursor;
+        }
+        return slot;
+    }
+
+    template<typename Fn>
+    void NonMaxSuppression::forEachOverlap(const BoxCorners& box, Fn&& fn) {
+        const BoxPlanes planes = candidateBoxes();
+        if (!useGrid) {
+            kernel.iouRow(planes, candidateCount, box, iou.data());
+            for (int slot = 0; slot < candidateCount; ++slot) {
+                if (iou[slot] > 0.0f && scores[slot] != -INFINITY) fn(slot, iou[slot]);
+            }
+            return;
+        }
+        ++visit;
+        const CellRange cells = cellsOf(box);
+        for (int row = cells.row0; row <= cells.row1; ++row) {
+            for (int column = cells.column0; column <= cells.column1; ++column) {
+                for (int entry = cellHeads[row * grid.columns + column]; entry >= 0; entry = entryNext[entry]) {
+                    const int slot = entryItem[entry];
+                    if (visits[slot] == visit || scores[slot] == -INFINITY) continue;
+                    visits[slot] = visit;
+                    const BoxCorners other{planes.x1[slot], planes.y1[slot], planes.x2[slot], planes.y2[slot], planes.area[slot]};
+                    const float overlap = cornersIou(other, box);
+                    if (overlap > 0.0f) fn(slot, overlap);
+                }
+            }
+        }
+    }
+
+    void NonMaxSuppression::selectSoft(const DetectionBox* boxes, int count, const SuppressionOptions& options, int limit) {
+        prepareCandidates(boxes, count);
+        const BoxPlanes planes = candidateBoxes();
+        const bool gaussian = options.mode == SuppressionMode::GAUSSIAN;
+        for (int best = nextBest(); best >= 0 && static_cast<int>(results.size()) < limit && scores[best] >= options.minScore;
+             best = nextBest()) {
+            const BoxCorners taken{planes.x1[best], planes.y1[best], planes.x2[best], planes.y2[best], planes.area[best]};
+            DetectionBox& result = results.emplace_back(boxes[candidates[best]]);
+            result.score = scores[best];
+            result.quality = scores[best];
+            scores[best] = -INFINITY;
+            // Decay the overlapping scores and drop the candidates that fall below the minimum
+            forEachOverlap(taken, [&](int slot, float overlap) {
+                float score = scores[slot];
+                if (gaussian) {
+                    score *= std::exp(-overlap * overlap / options.sigma);
+                } else if (overlap >= options.iouThreshold) {
+                    score *= 1.0f - overlap;
+                }
+                if (score == scores[slot]) return;
+                if (!(score >= options.minScore)) {
+                    scores[slot] = -INFINITY;
+                    return;
+                }
+                scores[slot] = score;
+                decayed[slot] = 1;
+                heap.emplace_back(score, slot);
+                std::push_heap(heap.begin(), heap.end(), heapOrder);
+            });
+        }
+    }
+
+    void NonMaxSuppression::selectWeighted(const DetectionBox* boxes, int count, float iouThreshold, int limit) {
+        prepareCandidates(boxes, count);
+        const BoxPlanes planes = candidateBoxes();
+        for (int best = nextBest(); best >= 0 && static_cast<int>(results.size()) < limit; best = nextBest()) {
+            const BoxCorners taken{planes.x1[best], planes.y1[best], planes.x2[best], planes.y2[best], planes.area[best]};
+            const DetectionBox& top = boxes[candidates[best]];
+            // Score-weighted sums of the cluster's bounds, landmarks and angles
+            DetectionBox& merged = results.emplace_back();
+            float weightSum = 0.0f;
+            auto add = [&](const DetectionBox& box, float weight) {
+                merged.bounds.x += weight * box.bounds.x;
+                merged.bounds.y += weight * box.bounds.y;
+                merged.bounds.width += weight * box.bounds.width;
+                merged.bounds.height += weight * box.bounds.height;
+                for (size_t j = 0; j < merged.landmarks.size(); ++j) {
+                    merged.landmarks[j].x += weight * box.landmarks[j].x;
+                    merged.landmarks[j].y += weight * box.landmarks[j].y;
+                }
+                merged.angle.yaw += weight * box.angle.yaw;
+                merged.angle.pitch += weight * box.angle.pitch;
+                merged.angle.roll += weight * box.angle.roll;
+                weightSum += weight;
+            };
+            add(top, top.score);
+            merged.score = top.score;
+            merged.quality = top.quality;
+            scores[best] = -INFINITY;
+            forEachOverlap(taken, [&](int slot, float overlap) {
+                if (overlap < iouThreshold) return;
+                add(boxes[candidates[slot]], scores[slot]);
+                scores[slot] = -INFINITY;
+            });
+            merged.bounds.x /= weightSum;
+            merged.bounds.y /= weightSum;
+            merged.bounds.width /= weightSum;
+            merged.bounds.height /= weightSum;
+            for (Point& point : merged.landmarks) {
+                point.x /= weightSum;
+                point.y /= weightSum;
+            }
+            merged.angle.yaw /= weightSum;
+            merged.angle.pitch /= weightSum;
+            merged.angle.roll /= weightSum;
+        }
+    }
+
+    namespace {
+        // Clusters of about 20 jittered candidates around faces spread over a 1920x1080 frame,
+        // as the detector produces them for a crowd
+        std::vector<DetectionBox> syntheticCrowd(int count, unsigned seed) {
+            std::mt19937 random(seed);
+            std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+            const int faceCount = std::max(count / 20, 1);
+            std::vector<Rect> faces(faceCount);
+            for (Rect& face : faces) {
+                const float size = 20.0f + 100.0f * unit(random);
+                face = {unit(random) * (1920.0f - size), unit(random) * (1080.0f - size), size, size * 1.2f};
+            }
+            std::vector<DetectionBox> boxes(count);
+            for (int i = 0; i < count; ++i) {
+                const Rect& face = faces[i % faceCount];
+                const float scale = 0.8f + 0.4f * unit(random);
+                boxes[i].bounds = {face.x + (unit(random) - 0.5f) * 0.2f * face.width,
+                                   face.y + (unit(random) - 0.5f) * 0.2f * face.height,
+                                   face.width * scale, face.height * scale};
+                boxes[i].score = 0.3f + 0.7f * unit(random);
+                boxes[i].quality = boxes[i].score;
+            }
+            return boxes;
+        }
+
+        // Candidate indices best first, ties to the lower index
+        std::vector<int> sortedByScore(const std::vector<DetectionBox>& boxes) {
+            std::vector<int> order(boxes.size());
+            std::iota(order.begin(), order.end(), 0);
+            std::sort(order.begin(), order.end(), [&](int a, int b) {
+                return boxes[a].score > boxes[b].score || (boxes[a].score == boxes[b].score && a < b);
+            });
+            return order;
+        }
+
+        // Scalar soft-NMS: takes the best remaining candidate, ties to the earlier in score order,
+        // until its decayed score falls below the minimum, and decays every other by its overlap
+        std::vector<DetectionBox> referenceSoft(const std::vector<DetectionBox>& boxes, const SuppressionOptions& options,
+                                                int limit) {
+            const std::vector<int> order = sortedByScore(boxes);
+            std::vector<float> scores(order.size());
+            for (size_t n = 0; n < order.size(); ++n) scores[n] = boxes[order[n]].score;
+            std::vector<DetectionBox> kept;
+            while (static_cast<int>(kept.size()) < limit) {
+                const auto best = std::max_element(scores.begin(), scores.end());
+                if (best == scores.end() || !(*best >= options.minScore)) break;
+                const size_t taken = best - scores.begin();
+                DetectionBox& box = kept.emplace_back(boxes[order[taken]]);
+                box.score = scores[taken];
+                box.quality = scores[taken];
+                scores[taken] = -INFINITY;
+                const BoxCorners corners = cornersOf(box.bounds);
+                for (size_t n = 0; n < order.size(); ++n) {
+                    if (scores[n] == -INFINITY) continue;
+                    const float overlap = cornersIou(cornersOf(boxes[order[n]].bounds), corners);
+                    if (options.mode == SuppressionMode::GAUSSIAN) {
+                        scores[n] *= std::exp(-overlap * overlap / options.sigma);
+                    } else if (overlap > 0.0f && overlap >= options.iouThreshold) {
+                        scores[n] *= 1.0f - overlap;
+                    }
+                }
+            }
+            return kept;
+        }
+
+        // Scalar weighted NMS: the best remaining candidate absorbs every remaining one overlapping
+        // it by the threshold or more, and their bounds are averaged by score
+        std::vector<DetectionBox> referenceWeighted(const std::vector<DetectionBox>& boxes, float iouThreshold, int limit) {
+            const std::vector<int> order = sortedByScore(boxes);
+            std::vector<bool> taken(order.size(), false);
+            std::vector<DetectionBox> kept;
+            for (size_t n = 0; n < order.size() && static_cast<int>(kept.size()) < limit; ++n) {
+                if (taken[n]) continue;
+                const DetectionBox& top = boxes[order[n]];
+                const BoxCorners corners = cornersOf(top.bounds);
+                double x = 0, y = 0, width = 0, height = 0, weightSum = 0;
+                for (size_t m = n; m < order.size(); ++m) {
+                    if (taken[m]) continue;
+                    const DetectionBox& box = boxes[order[m]];
+                    const float overlap = cornersIou(cornersOf(box.bounds), corners);
+                    if (m != n && !(overlap > 0.0f && overlap >= iouThreshold)) continue;
+                    taken[m] = true;
+                    x += box.score * box.bounds.x;
+                    y += box.score * box.bounds.y;
+                    width += box.score * box.bounds.width;
+                    height += box.score * box.bounds.height;
+                    weightSum += box.score;
+                }
+                DetectionBox& merged = kept.emplace_back(top);
+                merged.bounds = {static_cast<float>(x / weightSum), static_cast<float>(y / weightSum),
+                                 static_cast<float>(width / weightSum), static_cast<float>(height / weightSum)};
+            }
+            return kept;
+        }
+
+        // Same boxes in the same order; scores within rounding of the decay and bounds within
+        // rounding of the score-weighted sums, which the grid visits in another order
+        bool matchesReference(const std::vector<DetectionBox>& selected, const std::vector<DetectionBox>& expected) {
+            auto near = [](float a, float b, float tolerance) {
+                return std::fabs(a - b) <= tolerance * std::max(1.0f, std::fabs(b));
+            };
+            return selected.size() == expected.size() &&
+                   std::equal(selected.begin(), selected.end(), expected.begin(), [&](const DetectionBox& a, const DetectionBox& b) {
+                       return near(a.score, b.score, 1e-5f) && near(a.quality, b.quality, 1e-5f) &&
+                              near(a.bounds.x, b.bounds.x, 1e-4f) && near(a.bounds.y, b.bounds.y, 1e-4f) &&
+                              near(a.bounds.width, b.bounds.width, 1e-4f) && near(a.bounds.height, b.bounds.height, 1e-4f);
+                   });
+        }
+    }
+
+    bool verifyNonMaxSuppression() {
+        NonMaxSuppression nms(0);
+        std::vector<int> expected;
+        for (int count : {1, 100, 600, 1000, 5000, 10000}) {
+            const std::vector<DetectionBox> boxes = syntheticCrowd(count, static_cast<unsigned>(count));
+            for (float threshold : {0.4f, 0.3f, 0.6f, 0.0f}) {
+                for (int limit : {1, 31, 100, 1000}) {
+                    // Scalar greedy suppression over every candidate
+                    const std::vector<int> order = sortedByScore(boxes);
+                    expected.clear();
+                    for (int index : order) {
+                        if (static_cast<int>(expected.size()) >= limit) break;
+                        const BoxCorners box = cornersOf(boxes[index].bounds);
+                        if (std::none_of(expected.begin(), expected.end(), [&](int k) {
+                                return cornersIou(cornersOf(boxes[k].bounds), box) >= threshold;
+                            })) {
+                            expected.push_back(index);
+                        }
+                    }
+                    SuppressionOptions options;
+                    options.iouThreshold = threshold;
+                    const std::vector<DetectionBox>& selected = nms.select(boxes.data(), count, options, limit);
+                    if (selected.size() != expected.size() ||
+                        !std::equal(selected.begin(), selected.end(), expected.begin(), [&](const DetectionBox& box, int k) {
+                            return box.score == boxes[k].score && std::memcmp(&box.bounds, &boxes[k].bounds, sizeof(Rect)) == 0;
+                        })) {
+                        LOGI("Non-max suppression of %d boxes differs from the reference", count);
+                        return false;
+                    }
+                }
+            }
+        }
+        // Soft and weighted modes below and above the number of candidates that selects the grid,
+        // also with scores in steps of 1/64 so that many tie
+        for (int count : {1, 100, GRID_MIN_CANDIDATES - 1, GRID_MIN_CANDIDATES, 2000}) {
+            for (bool ties : {false, true}) {
+                std::vector<DetectionBox> boxes = syntheticCrowd(count, static_cast<unsigned>(count) + 1);
+                if (ties) {
+                    for (DetectionBox& box : boxes) {
+                        box.score = std::round(box.score * 64.0f) / 64.0f;
+                        box.quality = box.score;
+                    }
+                }
+                for (float threshold : {0.3f, 0.5f, 0.0f}) {
+                    for (int limit : {1, 31, 100}) {
+                        SuppressionOptions options;
+                        options.iouThreshold = threshold;
+                        for (SuppressionMode mode : {SuppressionMode::LINEAR, SuppressionMode::GAUSSIAN, SuppressionMode::WEIGHTED}) {
+                            options.mode = mode;
+                            const std::vector<DetectionBox> expected = mode == SuppressionMode::WEIGHTED
+                                    ? referenceWeighted(boxes, threshold, limit) : referenceSoft(boxes, options, limit);
+                            if (!matchesReference(nms.select(boxes.data(), count, options, limit), expected)) {
+                                LOGI("Suppression mode %d of %d boxes differs from the reference", static_cast<int>(mode), count);
+                                return false;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    double benchmarkNonMaxSuppression(int candidateCount, const SuppressionOptions& options, int iterations) {
+        const std::vector<DetectionBox> boxes = syntheticCrowd(candidateCount, 1);
+        NonMaxSuppression nms;
+        nms.select(boxes.data(), candidateCount, options, 100);
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            nms.select(boxes.data(), candidateCount, options, 100);
+        }
+        const std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count() / std::max(iterations, 1);
+    }
+
+}
@@ -0,0 +1,126 @@
+#ifndef FACE_DETECTION_NONMAXSUPPRESSION_H
+#define FACE_DETECTION_NONMAXSUPPRESSION_H
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "AlignedAllocator.h"
+#include "Postprocessing.h"
+#include "PostprocessingKernels.h"
+
+namespace verid {
+
+    enum class SuppressionMode : int {
+        // Drops every box overlapping a better one by the IoU threshold or more
+        HARD = 0,
+        // Soft-NMS scaling the scores of boxes overlapping a better one by the threshold or more by 1 - IoU
+        LINEAR = 1,
+        // Soft-NMS scaling the score of every overlapping box by exp(-IoU² / sigma)
+        GAUSSIAN = 2,
+        // Replaces each box and those overlapping it by the threshold or more with their average
+        // weighted by score, keeping the best score
+        WEIGHTED = 3,
+        // Decoding keeps only the local maxima of each anchor grid's scores; the few left are
+        // then suppressed as in HARD to merge the peaks of neighbouring feature maps
+        PEAKS = 4
+    };
+
+    struct SuppressionOptions {
+        SuppressionMode mode = SuppressionMode::HARD;
+        float iouThreshold = 0.4f;
+        // Width of the Gaussian decay
+        float sigma = 0.5f;
+        // Soft-NMS drops boxes whose score decays below this; the detector uses its score threshold
+        float minScore = 0.3f;
+    };
+
+    // Greedy non-max suppression that leaves the detections where they are. It sorts their
+    // indices and caps the candidates at the best topK first. Overlaps are found with the SIMD
+    // IoU kernel over all boxes of interest or, for many candidates, only among the boxes
+    // sharing a grid cell.
+    class NonMaxSuppression {
+    public:
+        // A topK of 0 or less keeps every candidate
+        explicit NonMaxSuppression(int topK = 5000);
+
+        // At most limit boxes, best first. In the soft modes scores and qualities are the decayed scores.
+        const std::vector<DetectionBox>& select(const DetectionBox* boxes, int count, const SuppressionOptions& options,
+                                                int limit);
+
+        void setTopK(int topK) { this->topK = topK; }
+        [[nodiscard]] int getTopK() const { return topK; }
+
+    private:
+        // Uniform grid over the candidates with cells about the size of an average box
+        struct Grid {
+            float originX = 0, originY = 0;
+            float cellWidth = 1, cellHeight = 1;
+            int columns = 1, rows = 1;
+        };
+        struct CellRange {
+            int column0, column1, row0, row1;
+        };
+
+        int topK;
+        PostprocessingKernel kernel;
+        // Sort keys and the candidate indices in the order they give
+        std::vector<uint64_t> keys;
+        std::vector<int> order;
+        std::vector<int> selected;
+        std::vector<DetectionBox> results;
+        // Corners and areas of the kept boxes, one plane each
+        AlignedVector<float> keptPlanes;
+        size_t keptStride = 0;
+        std::vector<float> iou;
+        // Candidates of the soft and weighted modes, in sorted order, as planes of corners and
+        // areas with their current scores (-infinity once taken or dropped) and indices
+        AlignedVector<float> candidatePlanes;
+        size_t candidateStride = 0;
+        int candidateCount = 0;
+        std::vector<float> scores;
+        std::vector<int> candidates;
+        // Best candidate: the first untouched one from the cursor on or the top of a lazily
+        // updated heap of decayed scores
+        int cursor = 0;
+        std::vector<uint8_t> decayed;
+        std::vector<std::pair<float, int>> heap;
+        // Items of each grid cell as linked lists of entries: kept boxes of the hard mode or
+        // candidates of the soft and weighted modes
+        Grid grid;
+        bool useGrid = false;
+        std::vector<int> cellHeads;
+        std::vector<int> entryNext;
+        std::vector<int> entryItem;
+        // Candidates already visited in the current grid search
+        std::vector<unsigned> visits;
+        unsigned visit = 0;
+
+        BoxPlanes keptBoxes() const;
+        void keep(const BoxCorners& box, int keptCount);
+        void selectAll(const DetectionBox* boxes, int count, float iouThreshold, int limit);
+        void selectInGrid(const DetectionBox* boxes, int count, float iouThreshold, int limit);
+        // Lays the grid over the first count sorted candidates; false if their extent is not finite
+        bool layGrid(const DetectionBox* boxes, int count);
+        [[nodiscard]] CellRange cellsOf(const BoxCorners& box) const;
+        void addToGrid(const CellRange& cells, int item);
+        void prepareCandidates(const DetectionBox* boxes, int count);
+        BoxPlanes candidateBoxes() const;
+        int nextBest();
+        // Calls fn(slot, iou) for every live candidate overlapping the box
+        template<typename Fn>
+        void forEachOverlap(const BoxCorners& box, Fn&& fn);
+        void selectSoft(const DetectionBox* boxes, int count, const SuppressionOptions& options, int limit);
+        void selectWeighted(const DetectionBox* boxes, int count, float iouThreshold, int limit);
+    };
+
+    // Checks that every mode but PEAKS, with and without the grid, keeps the same boxes as a scalar
+    // reference on synthetic crowds
+    bool verifyNonMaxSuppression();
+
+    // Mean time in microseconds to suppress a synthetic crowd of the given number of candidates
+    // down to 100 faces with the default top-K cap
+    double benchmarkNonMaxSuppression(int candidateCount, const SuppressionOptions& options, int iterations);
+
+}
+
+#endif //FACE_DETECTION_NONMAXSUPPRESSION_H
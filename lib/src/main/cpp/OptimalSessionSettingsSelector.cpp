@@ -9,8 +9,8 @@
 #include <iostream>
 #include <stdexcept>
 #include <algorithm>
-#include <unistd.h>
 #include "Logger.h"
+#include "SharedEnvironment.h"
 
 namespace verid {
 
@@ -68,9 +68,8 @@ namespace verid {
 
     Ort::SessionOptions createSessionOptions(bool useNnapi, uint32_t nnapiFlags) {
         Ort::SessionOptions options;
-        int cores = static_cast<int>(sysconf(_SC_NPROCESSORS_ONLN));
-        int numThreads = std::min(cores, 4);
-        options.SetIntraOpNumThreads(numThreads);
+        // Measured on the shared pools the detectors run on
+        useEnvironmentThreadPools(options);
         options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
         options.SetLogSeverityLevel(ORT_LOGGING_LEVEL_WARNING);
         if (useNnapi) {
@@ -89,7 +88,7 @@ namespace verid {
             const std::string& fp16modelPath,
             const std::string& int8modelPath)
     {
-        Ort::Env env(ORT_LOGGING_LEVEL_WARNING, LOG_TAG);
+        std::shared_ptr<Ort::Env> env = acquireEnvironment();
 
         std::vector<Options> combinations = {
                 {fp32modelPath, false, 0},
@@ -109,7 +108,7 @@ namespace verid {
         for (const auto& opt : combinations) {
             try {
                 auto sessionOptions = createSessionOptions(opt.useNnapi, opt.nnapiFlags);
-                Ort::Session session(env, opt.modelPath.c_str(), sessionOptions);
+                Ort::Session session(*env, opt.modelPath.c_str(), sessionOptions);
                 double avgMs = runInference(session, 2, 2);
                 results.push_back({opt, avgMs});
             } catch (const std::exception& e) {
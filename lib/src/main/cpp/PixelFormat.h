@@ -0,0 +1,58 @@
+#ifndef FACE_DETECTION_PIXELFORMAT_H
+#define FACE_DETECTION_PIXELFORMAT_H
+
+namespace verid {
+
+    // Matches the ordinals of com.appliedrec.verid3.common.ImageFormat
+    enum class PixelFormat : int {
+        RGB = 0,
+        BGR = 1,
+        ARGB = 2,
+        BGRA = 3,
+        ABGR = 4,
+        RGBA = 5,
+        GRAYSCALE = 6
+    };
+
+    // Byte layout of one pixel: size and offsets of the red, green and blue samples
+    template<PixelFormat Format>
+    struct PixelLayout;
+
+    template<>
+    struct PixelLayout<PixelFormat::RGB> {
+        static constexpr int bytesPerPixel = 3, r = 0, g = 1, b = 2;
+    };
+
+    template<>
+    struct PixelLayout<PixelFormat::BGR> {
+        static constexpr int bytesPerPixel = 3, r = 2, g = 1, b = 0;
+    };
+
+    template<>
+    struct PixelLayout<PixelFormat::ARGB> {
+        static constexpr int bytesPerPixel = 4, r = 1, g = 2, b = 3;
+    };
+
+    template<>
+    struct PixelLayout<PixelFormat::BGRA> {
+        static constexpr int bytesPerPixel = 4, r = 2, g = 1, b = 0;
+    };
+
+    template<>
+    struct PixelLayout<PixelFormat::ABGR> {
+        static constexpr int bytesPerPixel = 4, r = 3, g = 2, b = 1;
+    };
+
+    template<>
+    struct PixelLayout<PixelFormat::RGBA> {
+        static constexpr int bytesPerPixel = 4, r = 0, g = 1, b = 2;
+    };
+
+    template<>
+    struct PixelLayout<PixelFormat::GRAYSCALE> {
+        static constexpr int bytesPerPixel = 1, r = 0, g = 0, b = 0;
+    };
+
+}
+
+#endif //FACE_DETECTION_PIXELFORMAT_H
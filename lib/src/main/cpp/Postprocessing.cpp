@@ -6,156 +6,258 @@
 #include <vector>
 #include <cmath>
 #include <algorithm>
+#include <random>
+#include <stdexcept>
 #include <tuple>
+#include "HalfFloat.h"
+#include "Logger.h"
 
 namespace verid {
 
-    Postprocessing::Postprocessing(int imageWidth, int imageHeight)
-                : imageWidth(imageWidth), imageHeight(imageHeight), scoreThreshold(0.3f)
-    {
-        std::vector<std::vector<int>> minSizes = { {16, 32}, {64, 128}, {256, 512} };
-        std::vector<int> steps = { 8, 16, 32 };
-
-        int predictionCount = 0;
-        for (size_t k = 0; k < steps.size(); ++k) {
-            int step = steps[k];
-            int fH = static_cast<int>(std::ceil(static_cast<float>(imageHeight) / step));
-            int fW = static_cast<int>(std::ceil(static_cast<float>(imageWidth) / step));
-            predictionCount += fH * fW * static_cast<int>(minSizes[k].size());
-        }
-        int boxCount = 4;
-        int scoreCount = 2;
-        int landmarkCount = 10;
-
-        boxIndices.resize(boxCount);
-        for (int i = 0; i < boxCount; ++i) {
-            for (int j = i; j < predictionCount * boxCount; j += boxCount)
-                boxIndices[i].push_back(j);
-        }
+    namespace {
+        inline float toFloat(float value) { return value; }
+        inline float toFloat(uint16_t value) { return halfToFloat(value); }
+
+        // Anchor sizes and strides of the three feature maps
+        const std::vector<std::vector<int>> MIN_SIZES = { {16, 32}, {64, 128}, {256, 512} };
+        const std::vector<int> STEPS = { 8, 16, 32 };
+        // Input sizes whose tables are kept
+        constexpr size_t PRIOR_TABLE_CAPACITY = 4;
+
+        // Values per prior in the boxes, scores and landmarks outputs
+        constexpr int BOX_STRIDE = 4;
+        constexpr int SCORE_STRIDE = 2;
+        constexpr int LANDMARK_STRIDE = 10;
+        // Planes are padded to a multiple of this many floats
+        constexpr size_t PLANE_ALIGNMENT = 16;
+    }
 
-        scoreIndices.resize(scoreCount);
-        for (int i = 0; i < scoreCount; ++i) {
-            for (int j = i; j < predictionCount * scoreCount; j += scoreCount)
-                scoreIndices[i].push_back(j);
+    PriorTable::PriorTable(int width, int height) : width(width), height(height) {
+        for (size_t k = 0; k < STEPS.size(); ++k) {
+            int step = STEPS[k];
+            int fH = static_cast<int>(std::ceil(static_cast<float>(height) / step));
+            int fW = static_cast<int>(std::ceil(static_cast<float>(width) / step));
+            const int anchors = static_cast<int>(MIN_SIZES[k].size());
+            levels.push_back({fH, fW, anchors, count});
+            count += fH * fW * anchors;
         }
+        planeStride = (static_cast<size_t>(count) + PLANE_ALIGNMENT - 1) / PLANE_ALIGNMENT * PLANE_ALIGNMENT;
+        priors.assign(4 * planeStride, 0.0f);
+        float* cxPlane = priors.data();
+        float* cyPlane = cxPlane + planeStride;
+        float* widthPlane = cyPlane + planeStride;
+        float* heightPlane = widthPlane + planeStride;
+
+        size_t n = 0;
+        for (size_t k = 0; k < STEPS.size(); ++k) {
+            int step = STEPS[k];
+            int fH = (int)std::ceil((float)height / step);
+            int fW = (int)std::ceil((float)width / step);
 
-        landmarkIndices.resize(landmarkCount);
-        for (int i = 0; i < landmarkCount; ++i) {
-            for (int j = i; j < predictionCount * landmarkCount; j += landmarkCount)
-                landmarkIndices[i].push_back(j);
+            for (int i = 0; i < fH; ++i) {
+                for (int j = 0; j < fW; ++j) {
+                    for (int minSize : MIN_SIZES[k]) {
+                        cxPlane[n] = (j + 0.5f) * step / width;
+                        cyPlane[n] = (i + 0.5f) * step / height;
+                        widthPlane[n] = (float)minSize / width;
+                        heightPlane[n] = (float)minSize / height;
+                        ++n;
+                    }
+                }
+            }
         }
-
-        priors = generatePriors(minSizes, steps);
     }
 
-    std::vector<DetectionBox> Postprocessing::decode(
-            const std::vector<float>& boxesArray,
-            const std::vector<float>& scoresArray,
-            const std::vector<float>& landmarkArray)
+    Postprocessing::Postprocessing(int imageWidth, int imageHeight, WorkerPool& workerPool)
+                : imageWidth(imageWidth), imageHeight(imageHeight), workerPool(workerPool),
+                  kernel(selectedPostprocessingKernel())
     {
-        int count = scoresArray.size() / 2;
-        std::vector<float> confScores(count);
-        for (int i = 0; i < count; ++i) {
-            confScores[i] = scoresArray[scoreIndices[1][i]];
-        }
-
-        std::vector<int> retainedIndices;
-        for (int i = 0; i < count; ++i) {
-            if (confScores[i] >= scoreThreshold)
-                retainedIndices.push_back(i);
-        }
-        if (retainedIndices.empty()) return {};
-
-        const auto& cx = priors[0], &cy = priors[1], &pw = priors[2], &ph = priors[3];
-        std::vector<DetectionBox> detections;
-
-        for (int idx : retainedIndices) {
-            float dx = boxesArray[boxIndices[0][idx]];
-            float dy = boxesArray[boxIndices[1][idx]];
-            float dw = boxesArray[boxIndices[2][idx]];
-            float dh = boxesArray[boxIndices[3][idx]];
-
-            float adjX = cx[idx] + 0.1f * dx * pw[idx];
-            float adjY = cy[idx] + 0.1f * dy * ph[idx];
-            float expW = pw[idx] * std::exp(0.2f * dw);
-            float expH = ph[idx] * std::exp(0.2f * dh);
-
-            float x1 = adjX - expW / 2.0f;
-            float y1 = adjY - expH / 2.0f;
-
-            Rect rect = { x1 * imageWidth, y1 * imageHeight, expW * imageWidth, expH * imageHeight };
-
-            std::vector<Point> landmarkPoints;
-            for (int i = 0; i < 5; ++i) {
-                float lx = landmarkArray[landmarkIndices[2 * i][idx]];
-                float ly = landmarkArray[landmarkIndices[2 * i + 1][idx]];
+        priorTables.reserve(PRIOR_TABLE_CAPACITY);
+        priorTables.emplace_back(imageWidth, imageHeight);
+        candidates.resize(priorTables.front().count);
+    }
 
-                float pointX = cx[idx] + 0.1f * lx * pw[idx];
-                float pointY = cy[idx] + 0.1f * ly * ph[idx];
-                landmarkPoints.push_back({ pointX * imageWidth, pointY * imageHeight });
+    const PriorTable& Postprocessing::priorTableFor(int width, int height) {
+        auto it = std::find_if(priorTables.begin(), priorTables.end(), [&](const PriorTable& table) {
+            return table.width == width && table.height == height;
+        });
+        if (it == priorTables.end()) {
+            if (priorTables.size() >= PRIOR_TABLE_CAPACITY) {
+                priorTables.pop_back();
             }
+            it = priorTables.emplace(priorTables.begin(), width, height);
+            if (candidates.size() < static_cast<size_t>(it->count)) {
+                candidates.resize(it->count);
+            }
+        }
+        std::rotate(priorTables.begin(), it, it + 1);
+        return priorTables.front();
+    }
 
-            EulerAngle angle = calculateFaceAngle(
-                    landmarkPoints[0], landmarkPoints[1],
-                    landmarkPoints[2], landmarkPoints[3], landmarkPoints[4]
-            );
+    const PriorTable& Postprocessing::priorTableFor(const ModelOutputs& outputs) {
+        const PriorTable& table = outputs.inputWidth > 0 && outputs.inputHeight > 0
+                ? priorTableFor(outputs.inputWidth, outputs.inputHeight)
+                : priorTableFor(imageWidth, imageHeight);
+        if (outputs.count != table.count) {
+            throw std::runtime_error("Model output does not match the priors");
+        }
+        return table;
+    }
 
-            detections.push_back({ confScores[idx], rect, landmarkPoints, angle, confScores[idx] });
+    void Postprocessing::decode(const ModelOutputs& outputs, const DetectionFilter& filter,
+                                std::vector<DetectionBox>& detections, bool withLandmarks) {
+        const PriorTable& table = priorTableFor(outputs);
+        // Half precision outputs are read in place rather than converted to float copies
+        if (outputs.halfPrecision) {
+            decode(table, static_cast<const uint16_t*>(outputs.boxes), static_cast<const uint16_t*>(outputs.scores),
+                   withLandmarks ? static_cast<const uint16_t*>(outputs.landmarks) : nullptr, outputs.count, filter,
+                   detections);
+            return;
         }
+        decode(table, static_cast<const float*>(outputs.boxes), static_cast<const float*>(outputs.scores),
+               withLandmarks ? static_cast<const float*>(outputs.landmarks) : nullptr, outputs.count, filter, detections);
+    }
 
-        return detections;
+    void Postprocessing::decodeLandmarks(const ModelOutputs& outputs, DetectionBox& box) {
+        const PriorTable& table = priorTableFor(outputs);
+        if (box.prior < 0 || box.prior >= table.count) {
+            throw std::out_of_range("Box was not decoded from these outputs");
+        }
+        if (outputs.halfPrecision) {
+            decodeLandmarks(table, static_cast<const uint16_t*>(outputs.landmarks), box);
+        } else {
+            decodeLandmarks(table, static_cast<const float*>(outputs.landmarks), box);
+        }
     }
 
-    std::vector<DetectionBox> Postprocessing::nonMaxSuppression(
-            std::vector<DetectionBox>& boxes, float iouThreshold, int limit)
+    template<typename T>
+    void Postprocessing::decode(const PriorTable& table, const T* boxesArray, const T* scoresArray,
+                                const T* landmarkArray, int count, const DetectionFilter& filter,
+                                std::vector<DetectionBox>& detections)
     {
-        std::vector<DetectionBox> selected;
-        std::sort(boxes.begin(), boxes.end(),
-                  [](const DetectionBox& a, const DetectionBox& b) { return a.score > b.score; });
-
-        for (const auto& box : boxes) {
-            if ((int)selected.size() >= limit) break;
-            bool keep = true;
-            for (const auto& sel : selected) {
-                if (iou(sel.bounds, box.bounds) >= iouThreshold) {
-                    keep = false;
-                    break;
+        const float inputWidth = static_cast<float>(table.width), inputHeight = static_cast<float>(table.height);
+        // Vectorised scan of the scores in place; frames without faces end here
+        const int candidateCount = filter.localMaxima ? scanPeaks(table, scoresArray, filter.scoreThreshold)
+                                                      : scanScores(scoresArray, count, filter.scoreThreshold);
+        if (candidateCount == 0) return;
+
+        const float* cx = table.centerX();
+        const float* cy = table.centerY();
+        const float* pw = table.priorWidth();
+        const float* ph = table.priorHeight();
+        const size_t first = detections.size();
+        detections.resize(first + candidateCount);
+        DetectionBox* decoded = detections.data() + first;
+
+        workerPool.parallelFor(candidateCount, 64, [&](int, int begin, int end) {
+            for (int n = begin; n < end; ++n) {
+                const int idx = candidates[n];
+                const float score = toFloat(scoresArray[static_cast<size_t>(idx) * SCORE_STRIDE + 1]);
+                const T* box = boxesArray + static_cast<size_t>(idx) * BOX_STRIDE;
+                float dx = toFloat(box[0]);
+                float dy = toFloat(box[1]);
+                float dw = toFloat(box[2]);
+                float dh = toFloat(box[3]);
+
+                float adjX = cx[idx] + 0.1f * dx * pw[idx];
+                float adjY = cy[idx] + 0.1f * dy * ph[idx];
+                float expW = pw[idx] * std::exp(0.2f * dw);
+                float expH = ph[idx] * std::exp(0.2f * dh);
+
+                float x1 = adjX - expW / 2.0f;
+                float y1 = adjY - expH / 2.0f;
+
+                DetectionBox& det = decoded[n];
+                det.bounds = { x1 * inputWidth, y1 * inputHeight, expW * inputWidth, expH * inputHeight };
+                // Boxes of the wrong size are marked and removed once all bands are done
+                const float size = std::max(det.bounds.width, det.bounds.height);
+                if (!(size >= filter.minFaceSize && size <= filter.maxFaceSize)) {
+                    det.score = -INFINITY;
+                    continue;
+                }
+                det.score = score;
+                det.quality = score;
+                det.prior = idx;
+                if (landmarkArray) {
+                    decodeLandmarks(table, landmarkArray, det);
                 }
             }
-            if (keep) selected.push_back(box);
+        });
+        if (filter.minFaceSize > 0.0f || filter.maxFaceSize < INFINITY) {
+            detections.erase(std::remove_if(detections.begin() + static_cast<std::ptrdiff_t>(first), detections.end(),
+                                            [](const DetectionBox& det) { return det.score == -INFINITY; }),
+                             detections.end());
         }
-        return selected;
     }
 
-
-
-    [[nodiscard]] std::vector<std::vector<float>> Postprocessing::generatePriors(
-            const std::vector<std::vector<int>>& minSizes,
-            const std::vector<int>& steps) const {
-        std::vector<std::vector<float>> anchors(4);
-
-        for (size_t k = 0; k < steps.size(); ++k) {
-            int step = steps[k];
-            int fH = (int)std::ceil((float)imageHeight / step);
-            int fW = (int)std::ceil((float)imageWidth / step);
-
-            for (int i = 0; i < fH; ++i) {
-                for (int j = 0; j < fW; ++j) {
-                    for (int minSize : minSizes[k]) {
-                        float s_kx = (float)minSize / imageWidth;
-                        float s_ky = (float)minSize / imageHeight;
-                        float cx = (j + 0.5f) * step / imageWidth;
-                        float cy = (i + 0.5f) * step / imageHeight;
-
-                        anchors[0].push_back(cx);
-                        anchors[1].push_back(cy);
-                        anchors[2].push_back(s_kx);
-                        anchors[3].push_back(s_ky);
+    template<typename T>
+    int Postprocessing::scanPeaks(const PriorTable& table, const T* scores, float threshold) {
+        int found = 0;
+        for (const PriorLevel& level : table.levels) {
+            const int stride = level.columns + 2;
+            const size_t planeSize = static_cast<size_t>(level.rows + 2) * stride;
+            if (peakPlanes.size() < 2 * planeSize * level.anchors) {
+                peakPlanes.resize(2 * planeSize * level.anchors);
+            }
+            for (int a = 0; a < level.anchors; ++a) {
+                float* plane = peakPlanes.data() + 2 * planeSize * a;
+                float* columnMax = plane + planeSize;
+                std::fill(plane, plane + stride, -INFINITY);
+                std::fill(plane + planeSize - stride, plane + planeSize, -INFINITY);
+                for (int i = 0; i < level.rows; ++i) {
+                    float* row = plane + static_cast<size_t>(i + 1) * stride;
+                    const T* rowScores = scores + (static_cast<size_t>(level.first) + static_cast<size_t>(i) * level.columns * level.anchors + a) * SCORE_STRIDE + 1;
+                    row[0] = -INFINITY;
+                    row[level.columns + 1] = -INFINITY;
+                    for (int j = 0; j < level.columns; ++j) {
+                        row[j + 1] = toFloat(rowScores[static_cast<size_t>(j) * level.anchors * SCORE_STRIDE]);
+                    }
+                }
+                // Contiguous loop over the whole plane that the compiler vectorises; the border
+                // columns of the maxima are never read
+                for (size_t p = 1; p + 1 < planeSize; ++p) {
+                    columnMax[p] = std::max(std::max(plane[p - 1], plane[p]), plane[p + 1]);
+                }
+            }
+            // Peaks in prior order; the maxima over three rows are taken only above the threshold
+            for (int i = 0; i < level.rows; ++i) {
+                for (int j = 0; j < level.columns; ++j) {
+                    const size_t p = static_cast<size_t>(i + 1) * stride + j + 1;
+                    for (int a = 0; a < level.anchors; ++a) {
+                        const float* plane = peakPlanes.data() + 2 * planeSize * a;
+                        const float* columnMax = plane + planeSize;
+                        const float score = plane[p];
+                        if (!(score >= threshold)) continue;
+                        if (score >= std::max(std::max(columnMax[p - stride], columnMax[p]), columnMax[p + stride])) {
+                            candidates[found++] = level.first + (i * level.columns + j) * level.anchors + a;
+                        }
                     }
                 }
             }
         }
-        return anchors;
+        return found;
+    }
+
+    template<typename T>
+    void Postprocessing::decodeLandmarks(const PriorTable& table, const T* landmarkArray, DetectionBox& det) {
+        const int idx = det.prior;
+        const float inputWidth = static_cast<float>(table.width), inputHeight = static_cast<float>(table.height);
+        const float cx = table.centerX()[idx], cy = table.centerY()[idx];
+        const float pw = table.priorWidth()[idx], ph = table.priorHeight()[idx];
+        const T* landmarks = landmarkArray + static_cast<size_t>(idx) * LANDMARK_STRIDE;
+        for (int i = 0; i < 5; ++i) {
+            float lx = toFloat(landmarks[2 * i]);
+            float ly = toFloat(landmarks[2 * i + 1]);
+
+            float pointX = cx + 0.1f * lx * pw;
+            float pointY = cy + 0.1f * ly * ph;
+            det.landmarks[i] = { pointX * inputWidth, pointY * inputHeight };
+        }
+
+        det.angle = calculateFaceAngle(
+                det.landmarks[0], det.landmarks[1],
+                det.landmarks[2], det.landmarks[3], det.landmarks[4]
+        );
     }
 
     EulerAngle Postprocessing::calculateFaceAngle(const Point& leftEye, const Point& rightEye,
@@ -181,20 +283,83 @@ namespace verid {
         return { yaw, pitch, roll };
     }
 
-    float Postprocessing::iou(const Rect& a, const Rect& b) {
-        float x1 = std::max(a.x, b.x);
-        float y1 = std::max(a.y, b.y);
-        float x2 = std::min(a.x + a.width, b.x + b.width);
-        float y2 = std::min(a.y + a.height, b.y + b.height);
-
-        float interW = std::max(0.0f, x2 - x1);
-        float interH = std::max(0.0f, y2 - y1);
-        float interArea = interW * interH;
-
-        if (interArea <= 0.0f) return 0.0f;
-
-        float unionArea = a.width * a.height + b.width * b.height - interArea;
-        return interArea / unionArea;
+    bool verifyPriorTables() {
+        // Sizes with their prior counts: 2 anchors per cell of the stride 8, 16 and 32 feature maps
+        const std::tuple<int, int, int> sizes[] = {
+                {320, 320, 4200}, {320, 192, 2520}, {192, 320, 2520}, {640, 480, 12600}, {320, 96, 1260}
+        };
+        WorkerPool workerPool(2);
+        Postprocessing postprocessing(320, 320, workerPool);
+        std::mt19937 random(7);
+        std::uniform_real_distribution<float> offset(-2.0f, 2.0f);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        std::vector<DetectionBox> detections;
+        // Twice round, so tables are both found in the cache and rebuilt after eviction
+        for (int pass = 0; pass < 2; ++pass) {
+            for (const auto& [width, height, count] : sizes) {
+                if (postprocessing.priorCount(width, height) != count) {
+                    LOGI("Prior count at %dx%d differs from %d", width, height, count);
+                    return false;
+                }
+                std::vector<float> boxes(static_cast<size_t>(count) * BOX_STRIDE);
+                std::vector<float> scores(static_cast<size_t>(count) * SCORE_STRIDE);
+                std::vector<float> landmarks(static_cast<size_t>(count) * LANDMARK_STRIDE);
+                for (float& value : boxes) value = offset(random);
+                for (float& value : landmarks) value = offset(random);
+                for (float& value : scores) value = unit(random);
+                ModelOutputs outputs;
+                outputs.boxes = boxes.data();
+                outputs.scores = scores.data();
+                outputs.landmarks = landmarks.data();
+                outputs.count = count;
+                outputs.inputWidth = width;
+                outputs.inputHeight = height;
+                DetectionFilter filter;
+                detections.clear();
+                postprocessing.decode(outputs, filter, detections);
+                // Priors laid out row by row, feature map after feature map
+                size_t found = 0;
+                int prior = 0;
+                for (size_t k = 0; k < STEPS.size(); ++k) {
+                    const int step = STEPS[k];
+                    for (int i = 0; i < (height + step - 1) / step; ++i) {
+                        for (int j = 0; j < (width + step - 1) / step; ++j) {
+                            for (int minSize : MIN_SIZES[k]) {
+                                const int idx = prior++;
+                                const float score = scores[static_cast<size_t>(idx) * SCORE_STRIDE + 1];
+                                if (!(score >= filter.scoreThreshold)) continue;
+                                if (found >= detections.size()) return false;
+                                const DetectionBox& det = detections[found++];
+                                const float cx = (j + 0.5f) * step / width, cy = (i + 0.5f) * step / height;
+                                const float pw = static_cast<float>(minSize) / width, ph = static_cast<float>(minSize) / height;
+                                const float* box = boxes.data() + static_cast<size_t>(idx) * BOX_STRIDE;
+                                const float boxWidth = pw * std::exp(0.2f * box[2]), boxHeight = ph * std::exp(0.2f * box[3]);
+                                const float x = (cx + 0.1f * box[0] * pw - boxWidth / 2.0f) * width;
+                                const float y = (cy + 0.1f * box[1] * ph - boxHeight / 2.0f) * height;
+                                auto near = [](float a, float b) { return std::fabs(a - b) <= 1e-3f * std::max(1.0f, std::fabs(b)); };
+                                bool matches = det.prior == idx && det.score == score &&
+                                               near(det.bounds.x, x) && near(det.bounds.y, y) &&
+                                               near(det.bounds.width, boxWidth * width) && near(det.bounds.height, boxHeight * height);
+                                const float* point = landmarks.data() + static_cast<size_t>(idx) * LANDMARK_STRIDE;
+                                for (int p = 0; p < 5 && matches; ++p) {
+                                    matches = near(det.landmarks[p].x, (cx + 0.1f * point[2 * p] * pw) * width) &&
+                                              near(det.landmarks[p].y, (cy + 0.1f * point[2 * p + 1] * ph) * height);
+                                }
+                                if (!matches) {
+                                    LOGI("Decoding at %dx%d differs from the reference at prior %d", width, height, idx);
+                                    return false;
+                                }
+                            }
+                        }
+                    }
+                }
+                if (prior != count || found != detections.size()) {
+                    LOGI("Decoding at %dx%d kept %zu boxes, expected %zu", width, height, detections.size(), found);
+                    return false;
+                }
+            }
+        }
+        return true;
     }
 
 } // verid
@@ -1,7 +1,12 @@
 #ifndef FACE_DETECTION_POSTPROCESSING_H
 #define FACE_DETECTION_POSTPROCESSING_H
 
+#include <array>
+#include <cmath>
 #include <vector>
+#include "AlignedAllocator.h"
+#include "PostprocessingKernels.h"
+#include "WorkerPool.h"
 
 namespace verid {
 
@@ -20,32 +25,108 @@ namespace verid {
     struct DetectionBox {
         float score;
         Rect bounds;
-        std::vector<Point> landmarks;
+        // Eyes, nose tip and mouth corners
+        std::array<Point, 5> landmarks;
         EulerAngle angle;
         float quality;
+        // Prior the box was decoded from
+        int prior = -1;
+    };
+
+    // Model output tensors with 4 box, 2 score and 10 landmark values per prior,
+    // in float or IEEE half precision
+    struct ModelOutputs {
+        const void* boxes = nullptr;
+        const void* scores = nullptr;
+        const void* landmarks = nullptr;
+        int count = 0;
+        bool halfPrecision = false;
+        // Model input size the outputs were produced at, zero for the default size
+        int inputWidth = 0;
+        int inputHeight = 0;
+    };
+
+    // Candidates kept by decoding: a score of at least the threshold and a longer side of the box
+    // between the minimum and maximum face size, in model input pixels
+    struct DetectionFilter {
+        float scoreThreshold = 0.6f;
+        float minFaceSize = 0.0f;
+        float maxFaceSize = INFINITY;
+        // Keeps only candidates whose score is the maximum of the 3x3 neighbourhood on their anchor grid
+        bool localMaxima = false;
+    };
+
+    // Priors of one feature map: rows x columns cells of anchors priors each, starting at prior first
+    struct PriorLevel {
+        int rows = 0;
+        int columns = 0;
+        int anchors = 0;
+        int first = 0;
+    };
+
+    // Priors of one model input size as one aligned block of four planes: centre x, centre y,
+    // width and height, each padded to a whole number of SIMD blocks
+    struct PriorTable {
+        int width = 0;
+        int height = 0;
+        int count = 0;
+        size_t planeStride = 0;
+        AlignedVector<float> priors;
+        std::vector<PriorLevel> levels;
+
+        PriorTable(int width, int height);
+
+        [[nodiscard]] const float* centerX() const { return priors.data(); }
+        [[nodiscard]] const float* centerY() const { return priors.data() + planeStride; }
+        [[nodiscard]] const float* priorWidth() const { return priors.data() + 2 * planeStride; }
+        [[nodiscard]] const float* priorHeight() const { return priors.data() + 3 * planeStride; }
     };
 
     class Postprocessing {
     public:
-        explicit Postprocessing(int imageWidth, int imageHeight);
-        std::vector<DetectionBox> decode(
-                const std::vector<float>& boxesArray,
-                const std::vector<float>& scoresArray,
-                const std::vector<float>& landmarkArray);
-        static std::vector<DetectionBox> nonMaxSuppression(
-                std::vector<DetectionBox>& boxes, float iouThreshold, int limit);
+        Postprocessing(int imageWidth, int imageHeight, WorkerPool& workerPool);
+        // Appends the decoded candidates that pass the filter to detections, whose capacity is reused
+        // from frame to frame. Scores are rejected in the SIMD scan, sizes before the landmarks are decoded.
+        // Without landmarks only scores and bounds are decoded; decodeLandmarks completes the boxes kept later.
+        void decode(const ModelOutputs& outputs, const DetectionFilter& filter, std::vector<DetectionBox>& detections,
+                    bool withLandmarks = true);
+        // Landmarks and angle of a box decoded from the same outputs without them
+        void decodeLandmarks(const ModelOutputs& outputs, DetectionBox& box);
+        // Number of priors, and so of model outputs, at the given input size
+        int priorCount(int width, int height) { return priorTableFor(width, height).count; }
     private:
         int imageWidth, imageHeight;
-        float scoreThreshold;
-        std::vector<std::vector<int>> boxIndices, scoreIndices, landmarkIndices;
-        std::vector<std::vector<float>> priors;
-        [[nodiscard]] std::vector<std::vector<float>> generatePriors(
-                const std::vector<std::vector<int>>& minSizes,
-                const std::vector<int>& steps) const;
+        // Candidates are decoded in bands on the detector's worker pool
+        WorkerPool& workerPool;
+        // Tables of recently used input sizes, most recently used first
+        std::vector<PriorTable> priorTables;
+        PostprocessingKernel kernel;
+        // Indices of the priors that pass the score threshold, sized for the largest table
+        std::vector<int> candidates;
+        // Score planes of one feature map's anchors framed by -infinity and their maxima over three columns
+        AlignedVector<float> peakPlanes;
+        const PriorTable& priorTableFor(int width, int height);
+        int scanScores(const float* scores, int count, float threshold) {
+            return kernel.scanScores(scores, count, threshold, candidates.data());
+        }
+        int scanScores(const uint16_t* scores, int count, float threshold) {
+            return kernel.scanHalfScores(scores, count, threshold, candidates.data());
+        }
+        const PriorTable& priorTableFor(const ModelOutputs& outputs);
+        template<typename T>
+        int scanPeaks(const PriorTable& table, const T* scores, float threshold);
+        template<typename T>
+        void decode(const PriorTable& table, const T* boxesArray, const T* scoresArray, const T* landmarkArray,
+                    int count, const DetectionFilter& filter, std::vector<DetectionBox>& detections);
+        template<typename T>
+        static void decodeLandmarks(const PriorTable& table, const T* landmarkArray, DetectionBox& det);
         static EulerAngle calculateFaceAngle(const Point& leftEye, const Point& rightEye,
                                              const Point& noseTip, const Point& leftMouth,
                                              const Point& rightMouth);
-        static float iou(const Rect& a, const Rect& b);
     };
+
+    // Checks the prior counts of square and non-square input sizes and that decoding at more sizes
+    // than the prior table cache holds, in turn, matches a scalar reference
+    bool verifyPriorTables();
 }
 #endif //FACE_DETECTION_POSTPROCESSING_H
\ No newline at end of file
@@ -0,0 +1,399 @@
+#include "PostprocessingKernels.h"
+#include <algorithm>
+#include <random>
+#include "HalfFloat.h"
+#include "Logger.h"
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VERID_X86_KERNELS 1
+#endif
+
+namespace verid {
+
+    namespace {
+
+        // Scalar scan of the priors [begin, count) left over after the last whole block
+        inline int scanTail(const float* scores, int begin, int count, float threshold, int* indices, int n) {
+            for (int i = begin; i < count; ++i) {
+                if (scores[2 * i + 1] >= threshold) indices[n++] = i;
+            }
+            return n;
+        }
+
+        inline int scanTail(const uint16_t* scores, int begin, int count, float threshold, int* indices, int n) {
+            for (int i = begin; i < count; ++i) {
+                if (halfToFloat(scores[2 * i + 1]) >= threshold) indices[n++] = i;
+            }
+            return n;
+        }
+
+        int scanScoresScalar(const float* scores, int count, float threshold, int* indices) {
+            return scanTail(scores, 0, count, threshold, indices, 0);
+        }
+
+        int scanHalfScoresScalar(const uint16_t* scores, int count, float threshold, int* indices) {
+            return scanTail(scores, 0, count, threshold, indices, 0);
+        }
+
+        inline void iouTail(const BoxPlanes& boxes, int begin, int count, const BoxCorners& box, float* iou) {
+            for (int i = begin; i < count; ++i) {
+                iou[i] = cornersIou({boxes.x1[i], boxes.y1[i], boxes.x2[i], boxes.y2[i], boxes.area[i]}, box);
+            }
+        }
+
+        void iouRowScalar(const BoxPlanes& boxes, int count, const BoxCorners& box, float* iou) {
+            iouTail(boxes, 0, count, box, iou);
+        }
+
+        // Appends first + (bit >> shift) for every set bit of mask. Most blocks have no
+        // candidates, so the caller only gets here for the rare block that does.
+        inline int emitCandidates(uint32_t mask, int first, int shift, int* indices, int n) {
+            while (mask) {
+                indices[n++] = first + (__builtin_ctz(mask) >> shift);
+                mask &= mask - 1;
+            }
+            return n;
+        }
+
+        // Non-negative half precision values order like their bit patterns, so for a positive
+        // threshold a score passes exactly when its bits lie in [smallest passing half, infinity].
+        // Negative scores have the sign bit set and NaNs lie above infinity, so both fail as in
+        // the scalar reference.
+        inline uint16_t smallestPassingHalf(float threshold) {
+            uint16_t h = floatToHalf(threshold);
+            if (halfToFloat(h) < threshold) ++h;
+            return h;
+        }
+
+        constexpr uint16_t HALF_INFINITY = 0x7C00;
+
+#if defined(__ARM_NEON)
+        inline bool anyLane(uint16x8_t v) {
+            const uint64x2_t wide = vreinterpretq_u64_u16(v);
+            return (vgetq_lane_u64(wide, 0) | vgetq_lane_u64(wide, 1)) != 0;
+        }
+
+        inline uint32_t laneMask(uint16x8_t v) {
+            static const uint16_t bits[8] = {1, 2, 4, 8, 16, 32, 64, 128};
+            const uint16x8_t masked = vandq_u16(v, vld1q_u16(bits));
+            uint16x4_t sum = vadd_u16(vget_low_u16(masked), vget_high_u16(masked));
+            sum = vpadd_u16(sum, sum);
+            sum = vpadd_u16(sum, sum);
+            return vget_lane_u16(sum, 0);
+        }
+
+        int scanScoresNeon(const float* scores, int count, float threshold, int* indices) {
+            int n = 0;
+            int i = 0;
+            const float32x4_t t = vdupq_n_f32(threshold);
+            for (; i + 8 <= count; i += 8) {
+                // De-interleave so val[1] holds the foreground scores
+                const float32x4x2_t a = vld2q_f32(scores + 2 * i);
+                const float32x4x2_t b = vld2q_f32(scores + 2 * i + 8);
+                const uint16x8_t pass = vcombine_u16(vmovn_u32(vcgeq_f32(a.val[1], t)), vmovn_u32(vcgeq_f32(b.val[1], t)));
+                if (anyLane(pass)) n = emitCandidates(laneMask(pass), i, 0, indices, n);
+            }
+            return scanTail(scores, i, count, threshold, indices, n);
+        }
+
+        int scanHalfScoresNeon(const uint16_t* scores, int count, float threshold, int* indices) {
+            if (!(threshold > 0.0f)) return scanHalfScoresScalar(scores, count, threshold, indices);
+            int n = 0;
+            int i = 0;
+            const uint16x8_t low = vdupq_n_u16(smallestPassingHalf(threshold));
+            const uint16x8_t high = vdupq_n_u16(HALF_INFINITY);
+            for (; i + 8 <= count; i += 8) {
+                const uint16x8_t fg = vld2q_u16(scores + 2 * i).val[1];
+                const uint16x8_t pass = vandq_u16(vcgeq_u16(fg, low), vcleq_u16(fg, high));
+                if (anyLane(pass)) n = emitCandidates(laneMask(pass), i, 0, indices, n);
+            }
+            return scanTail(scores, i, count, threshold, indices, n);
+        }
+
+        // Same operations in the same order as cornersIou, so the results match it bit for bit
+        void iouRowNeon(const BoxPlanes& boxes, int count, const BoxCorners& box, float* iou) {
+            const float32x4_t x1 = vdupq_n_f32(box.x1);
+            const float32x4_t y1 = vdupq_n_f32(box.y1);
+            const float32x4_t x2 = vdupq_n_f32(box.x2);
+            const float32x4_t y2 = vdupq_n_f32(box.y2);
+            const float32x4_t area = vdupq_n_f32(box.area);
+            const float32x4_t zero = vdupq_n_f32(0.0f);
+            int i = 0;
+            for (; i + 4 <= count; i += 4) {
+                const float32x4_t width = vmaxq_f32(vsubq_f32(vminq_f32(vld1q_f32(boxes.x2 + i), x2), vmaxq_f32(vld1q_f32(boxes.x1 + i), x1)), zero);
+                const float32x4_t height = vmaxq_f32(vsubq_f32(vminq_f32(vld1q_f32(boxes.y2 + i), y2), vmaxq_f32(vld1q_f32(boxes.y1 + i), y1)), zero);
+                const float32x4_t intersection = vmulq_f32(width, height);
+                const float32x4_t unionArea = vsubq_f32(vaddq_f32(vld1q_f32(boxes.area + i), area), intersection);
+                const uint32x4_t overlaps = vcgtq_f32(intersection, zero);
+                vst1q_f32(iou + i, vreinterpretq_f32_u32(vandq_u32(overlaps, vreinterpretq_u32_f32(vdivq_f32(intersection, unionArea)))));
+            }
+            iouTail(boxes, i, count, box, iou);
+        }
+#endif
+
+#ifdef VERID_X86_KERNELS
+        __attribute__((target("sse2")))
+        int scanScoresSse2(const float* scores, int count, float threshold, int* indices) {
+            int n = 0;
+            int i = 0;
+            const __m128 t = _mm_set1_ps(threshold);
+            for (; i + 8 <= count; i += 8) {
+                // Two priors per register; the foreground scores are the odd bits of the mask
+                const float* p = scores + 2 * i;
+                const uint32_t mask = static_cast<uint32_t>(_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(p), t)))
+                        | static_cast<uint32_t>(_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(p + 4), t))) << 4
+                        | static_cast<uint32_t>(_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(p + 8), t))) << 8
+                        | static_cast<uint32_t>(_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(p + 12), t))) << 12;
+                if (mask & 0xAAAAu) n = emitCandidates(mask & 0xAAAAu, i, 1, indices, n);
+            }
+            return scanTail(scores, i, count, threshold, indices, n);
+        }
+
+        __attribute__((target("sse2")))
+        int scanHalfScoresSse2(const uint16_t* scores, int count, float threshold, int* indices) {
+            if (!(threshold > 0.0f)) return scanHalfScoresScalar(scores, count, threshold, indices);
+            int n = 0;
+            int i = 0;
+            // Shifting each 32-bit pair right by 16 leaves the foreground half as a non-negative int
+            const __m128i low = _mm_set1_epi32(smallestPassingHalf(threshold) - 1);
+            const __m128i high = _mm_set1_epi32(HALF_INFINITY + 1);
+            for (; i + 8 <= count; i += 8) {
+                const __m128i a = _mm_srli_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(scores + 2 * i)), 16);
+                const __m128i b = _mm_srli_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(scores + 2 * i + 8)), 16);
+                const __m128i passA = _mm_and_si128(_mm_cmpgt_epi32(a, low), _mm_cmplt_epi32(a, high));
+                const __m128i passB = _mm_and_si128(_mm_cmpgt_epi32(b, low), _mm_cmplt_epi32(b, high));
+                const uint32_t mask = static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(passA)))
+                        | static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(passB))) << 4;
+                if (mask) n = emitCandidates(mask, i, 0, indices, n);
+            }
+            return scanTail(scores, i, count, threshold, indices, n);
+        }
+
+        __attribute__((target("avx2")))
+        int scanScoresAvx2(const float* scores, int count, float threshold, int* indices) {
+            int n = 0;
+            int i = 0;
+            const __m256 t = _mm256_set1_ps(threshold);
+            for (; i + 8 <= count; i += 8) {
+                const float* p = scores + 2 * i;
+                const uint32_t mask = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(p), t, _CMP_GE_OQ)))
+                        | static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(p + 8), t, _CMP_GE_OQ))) << 8;
+                if (mask & 0xAAAAu) n = emitCandidates(mask & 0xAAAAu, i, 1, indices, n);
+            }
+            return scanTail(scores, i, count, threshold, indices, n);
+        }
+
+        __attribute__((target("avx2")))
+        int scanHalfScoresAvx2(const uint16_t* scores, int count, float threshold, int* indices) {
+            if (!(threshold > 0.0f)) return scanHalfScoresScalar(scores, count, threshold, indices);
+            int n = 0;
+            int i = 0;
+            const __m256i low = _mm256_set1_epi32(smallestPassingHalf(threshold) - 1);
+            const __m256i high = _mm256_set1_epi32(HALF_INFINITY + 1);
+            for (; i + 16 <= count; i += 16) {
+                const __m256i a = _mm256_srli_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(scores + 2 * i)), 16);
+                const __m256i b = _mm256_srli_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(scores + 2 * i + 16)), 16);
+                const __m256i passA = _mm256_and_si256(_mm256_cmpgt_epi32(a, low), _mm256_cmpgt_epi32(high, a));
+                const __m256i passB = _mm256_and_si256(_mm256_cmpgt_epi32(b, low), _mm256_cmpgt_epi32(high, b));
+                const uint32_t mask = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(passA)))
+                        | static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(passB))) << 8;
+                if (mask) n = emitCandidates(mask, i, 0, indices, n);
+            }
+            return scanTail(scores, i, count, threshold, indices, n);
+        }
+
+        __attribute__((target("avx512f")))
+        int scanScoresAvx512(const float* scores, int count, float threshold, int* indices) {
+            int n = 0;
+            int i = 0;
+            const __m512 t = _mm512_set1_ps(threshold);
+            for (; i + 16 <= count; i += 16) {
+                const float* p = scores + 2 * i;
+                const uint32_t mask = static_cast<uint32_t>(_mm512_cmp_ps_mask(_mm512_loadu_ps(p), t, _CMP_GE_OQ))
+                        | static_cast<uint32_t>(_mm512_cmp_ps_mask(_mm512_loadu_ps(p + 16), t, _CMP_GE_OQ)) << 16;
+                if (mask & 0xAAAAAAAAu) n = emitCandidates(mask & 0xAAAAAAAAu, i, 1, indices, n);
+            }
+            return scanTail(scores, i, count, threshold, indices, n);
+        }
+
+        __attribute__((target("avx512f")))
+        int scanHalfScoresAvx512(const uint16_t* scores, int count, float threshold, int* indices) {
+            if (!(threshold > 0.0f)) return scanHalfScoresScalar(scores, count, threshold, indices);
+            int n = 0;
+            int i = 0;
+            const __m512i low = _mm512_set1_epi32(smallestPassingHalf(threshold));
+            const __m512i high = _mm512_set1_epi32(HALF_INFINITY);
+            for (; i + 16 <= count; i += 16) {
+                const __m512i fg = _mm512_srli_epi32(_mm512_loadu_si512(scores + 2 * i), 16);
+                const uint32_t mask = _mm512_cmpge_epi32_mask(fg, low) & _mm512_cmple_epi32_mask(fg, high);
+                if (mask) n = emitCandidates(mask, i, 0, indices, n);
+            }
+            return scanTail(scores, i, count, threshold, indices, n);
+        }
+
+        __attribute__((target("sse2")))
+        void iouRowSse2(const BoxPlanes& boxes, int count, const BoxCorners& box, float* iou) {
+            const __m128 x1 = _mm_set1_ps(box.x1);
+            const __m128 y1 = _mm_set1_ps(box.y1);
+            const __m128 x2 = _mm_set1_ps(box.x2);
+            const __m128 y2 = _mm_set1_ps(box.y2);
+            const __m128 area = _mm_set1_ps(box.area);
+            const __m128 zero = _mm_setzero_ps();
+            int i = 0;
+            for (; i + 4 <= count; i += 4) {
+                const __m128 width = _mm_max_ps(_mm_sub_ps(_mm_min_ps(_mm_loadu_ps(boxes.x2 + i), x2), _mm_max_ps(_mm_loadu_ps(boxes.x1 + i), x1)), zero);
+                const __m128 height = _mm_max_ps(_mm_sub_ps(_mm_min_ps(_mm_loadu_ps(boxes.y2 + i), y2), _mm_max_ps(_mm_loadu_ps(boxes.y1 + i), y1)), zero);
+                const __m128 intersection = _mm_mul_ps(width, height);
+                const __m128 unionArea = _mm_sub_ps(_mm_add_ps(_mm_loadu_ps(boxes.area + i), area), intersection);
+                _mm_storeu_ps(iou + i, _mm_and_ps(_mm_cmpgt_ps(intersection, zero), _mm_div_ps(intersection, unionArea)));
+            }
+            iouTail(boxes, i, count, box, iou);
+        }
+
+        __attribute__((target("avx2")))
+        void iouRowAvx2(const BoxPlanes& boxes, int count, const BoxCorners& box, float* iou) {
+            const __m256 x1 = _mm256_set1_ps(box.x1);
+            const __m256 y1 = _mm256_set1_ps(box.y1);
+            const __m256 x2 = _mm256_set1_ps(box.x2);
+            const __m256 y2 = _mm256_set1_ps(box.y2);
+            const __m256 area = _mm256_set1_ps(box.area);
+            const __m256 zero = _mm256_setzero_ps();
+            int i = 0;
+            for (; i + 8 <= count; i += 8) {
+                const __m256 width = _mm256_max_ps(_mm256_sub_ps(_mm256_min_ps(_mm256_loadu_ps(boxes.x2 + i), x2), _mm256_max_ps(_mm256_loadu_ps(boxes.x1 + i), x1)), zero);
+                const __m256 height = _mm256_max_ps(_mm256_sub_ps(_mm256_min_ps(_mm256_loadu_ps(boxes.y2 + i), y2), _mm256_max_ps(_mm256_loadu_ps(boxes.y1 + i), y1)), zero);
+                const __m256 intersection = _mm256_mul_ps(width, height);
+                const __m256 unionArea = _mm256_sub_ps(_mm256_add_ps(_mm256_loadu_ps(boxes.area + i), area), intersection);
+                _mm256_storeu_ps(iou + i, _mm256_and_ps(_mm256_cmp_ps(intersection, zero, _CMP_GT_OQ), _mm256_div_ps(intersection, unionArea)));
+            }
+            iouTail(boxes, i, count, box, iou);
+        }
+
+        __attribute__((target("avx512f")))
+        void iouRowAvx512(const BoxPlanes& boxes, int count, const BoxCorners& box, float* iou) {
+            const __m512 x1 = _mm512_set1_ps(box.x1);
+            const __m512 y1 = _mm512_set1_ps(box.y1);
+            const __m512 x2 = _mm512_set1_ps(box.x2);
+            const __m512 y2 = _mm512_set1_ps(box.y2);
+            const __m512 area = _mm512_set1_ps(box.area);
+            const __m512 zero = _mm512_setzero_ps();
+            int i = 0;
+            for (; i + 16 <= count; i += 16) {
+                const __m512 width = _mm512_max_ps(_mm512_sub_ps(_mm512_min_ps(_mm512_loadu_ps(boxes.x2 + i), x2), _mm512_max_ps(_mm512_loadu_ps(boxes.x1 + i), x1)), zero);
+                const __m512 height = _mm512_max_ps(_mm512_sub_ps(_mm512_min_ps(_mm512_loadu_ps(boxes.y2 + i), y2), _mm512_max_ps(_mm512_loadu_ps(boxes.y1 + i), y1)), zero);
+                const __m512 intersection = _mm512_mul_ps(width, height);
+                const __m512 unionArea = _mm512_sub_ps(_mm512_add_ps(_mm512_loadu_ps(boxes.area + i), area), intersection);
+                const __mmask16 overlaps = _mm512_cmp_ps_mask(intersection, zero, _CMP_GT_OQ);
+                _mm512_storeu_ps(iou + i, _mm512_maskz_div_ps(overlaps, intersection, unionArea));
+            }
+            iouTail(boxes, i, count, box, iou);
+        }
+#endif
+
+    }
+
+    std::vector<PostprocessingKernel> supportedPostprocessingKernels() {
+        std::vector<PostprocessingKernel> kernels;
+#if defined(__ARM_NEON)
+        kernels.push_back({"NEON", scanScoresNeon, scanHalfScoresNeon, iouRowNeon});
+#elif defined(VERID_X86_KERNELS)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) {
+            kernels.push_back({"AVX-512", scanScoresAvx512, scanHalfScoresAvx512, iouRowAvx512});
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            kernels.push_back({"AVX2", scanScoresAvx2, scanHalfScoresAvx2, iouRowAvx2});
+        }
+        if (__builtin_cpu_supports("sse2")) {
+            kernels.push_back({"SSE2", scanScoresSse2, scanHalfScoresSse2, iouRowSse2});
+        }
+#endif
+        kernels.push_back({"Scalar", scanScoresScalar, scanHalfScoresScalar, iouRowScalar});
+        return kernels;
+    }
+
+    const PostprocessingKernel& selectedPostprocessingKernel() {
+        static const PostprocessingKernel kernel = [] {
+            PostprocessingKernel selected = supportedPostprocessingKernels().front();
+            LOGI("Using %s postprocessing kernel", selected.name);
+            return selected;
+        }();
+        return kernel;
+    }
+
+    bool verifyPostprocessingKernels() {
+        // Scores around each threshold, special values and every half precision bit pattern
+        std::vector<float> scores(2 * 65536 + 64);
+        std::vector<uint16_t> halfScores(scores.size());
+        for (size_t i = 0; i < scores.size(); ++i) {
+            halfScores[i] = static_cast<uint16_t>(i * 40503u >> 7);
+            scores[i] = halfToFloat(halfScores[i]);
+        }
+        for (size_t i = 1; i < 64; i += 2) {
+            halfScores[i] = static_cast<uint16_t>(0x7C00 + i);
+            scores[i] = static_cast<float>(i) / 64.0f;
+        }
+        std::vector<int> expected(scores.size() / 2);
+        std::vector<int> actual(scores.size() / 2);
+        for (const auto& kernel : supportedPostprocessingKernels()) {
+            for (int offset = 0; offset < 16; ++offset) {
+                for (int count : {0, 1, 7, 8, 9, 15, 16, 17, 33, 4200, 65536}) {
+                    for (float threshold : {0.3f, 0.5f, 0.0f, -1.0f, 1e-6f, 0.2999f, 65504.0f, 70000.0f}) {
+                        const int n = scanScoresScalar(scores.data() + 2 * offset, count, threshold, expected.data());
+                        if (kernel.scanScores(scores.data() + 2 * offset, count, threshold, actual.data()) != n
+                            || !std::equal(expected.begin(), expected.begin() + n, actual.begin())) {
+                            LOGI("%s postprocessing kernel differs from scalar reference", kernel.name);
+                            return false;
+                        }
+                        const int nHalf = scanHalfScoresScalar(halfScores.data() + 2 * offset, count, threshold, expected.data());
+                        if (kernel.scanHalfScores(halfScores.data() + 2 * offset, count, threshold, actual.data()) != nHalf
+                            || !std::equal(expected.begin(), expected.begin() + nHalf, actual.begin())) {
+                            LOGI("%s postprocessing kernel differs from scalar reference for half precision", kernel.name);
+                            return false;
+                        }
+                    }
+                }
+            }
+        }
+        // Overlapping, touching, nested, disjoint and identical boxes
+        std::mt19937 random(17);
+        std::uniform_real_distribution<float> position(0.0f, 100.0f);
+        std::uniform_real_distribution<float> size(0.0f, 40.0f);
+        const int boxCount = 67;
+        std::vector<float> planes(5 * boxCount);
+        BoxPlanes boxes{planes.data(), planes.data() + boxCount, planes.data() + 2 * boxCount,
+                        planes.data() + 3 * boxCount, planes.data() + 4 * boxCount};
+        for (int i = 0; i < boxCount; ++i) {
+            const float x = i % 5 == 0 ? 30.0f : position(random);
+            const float y = i % 5 == 0 ? 30.0f : position(random);
+            const float width = i % 7 == 0 ? 0.0f : size(random);
+            const float height = size(random);
+            planes[i] = x;
+            planes[boxCount + i] = y;
+            planes[2 * boxCount + i] = i % 11 == 0 ? x + 40.0f : x + width;
+            planes[3 * boxCount + i] = y + height;
+            planes[4 * boxCount + i] = (planes[2 * boxCount + i] - x) * height;
+        }
+        std::vector<float> expectedIou(boxCount);
+        std::vector<float> actualIou(boxCount);
+        for (const auto& kernel : supportedPostprocessingKernels()) {
+            for (int count = 0; count <= boxCount; ++count) {
+                for (int j = 0; j < boxCount; j += 3) {
+                    const BoxCorners box{planes[j], planes[boxCount + j], planes[2 * boxCount + j],
+                                         planes[3 * boxCount + j], planes[4 * boxCount + j]};
+                    iouRowScalar(boxes, count, box, expectedIou.data());
+                    kernel.iouRow(boxes, count, box, actualIou.data());
+                    if (!std::equal(expectedIou.begin(), expectedIou.begin() + count, actualIou.begin())) {
+                        LOGI("%s postprocessing kernel computes IoU differently from scalar reference", kernel.name);
+                        return false;
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+}
@@ -0,0 +1,62 @@
+#ifndef FACE_DETECTION_POSTPROCESSINGKERNELS_H
+#define FACE_DETECTION_POSTPROCESSINGKERNELS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace verid {
+
+    // Reads the (background, foreground) score pairs of count priors in place and writes the indices
+    // of priors whose foreground score is at least the threshold, in ascending order. Returns how many
+    // indices were written; indices must have room for count.
+    using ScanScoresFn = int (*)(const float* scores, int count, float threshold, int* indices);
+    // Same as ScanScoresFn for IEEE half precision scores
+    using ScanHalfScoresFn = int (*)(const uint16_t* scores, int count, float threshold, int* indices);
+
+    // Box given by its corners, with its area precomputed
+    struct BoxCorners {
+        float x1, y1, x2, y2, area;
+    };
+
+    // Boxes as one plane per corner coordinate and one of areas, read in whole SIMD blocks
+    // up to the count and element by element after it
+    struct BoxPlanes {
+        const float* x1;
+        const float* y1;
+        const float* x2;
+        const float* y2;
+        const float* area;
+    };
+
+    // Intersection over union exactly as every IouRowFn computes it
+    inline float cornersIou(const BoxCorners& a, const BoxCorners& b) {
+        const float width = std::max(0.0f, std::min(a.x2, b.x2) - std::max(a.x1, b.x1));
+        const float height = std::max(0.0f, std::min(a.y2, b.y2) - std::max(a.y1, b.y1));
+        const float intersection = width * height;
+        return intersection > 0.0f ? intersection / (a.area + b.area - intersection) : 0.0f;
+    }
+
+    // Writes the IoU of the box with each of the first count boxes of the planes to iou
+    using IouRowFn = void (*)(const BoxPlanes& boxes, int count, const BoxCorners& box, float* iou);
+
+    struct PostprocessingKernel {
+        const char* name;
+        ScanScoresFn scanScores;
+        ScanHalfScoresFn scanHalfScores;
+        IouRowFn iouRow;
+    };
+
+    // Fastest kernel supported by the CPU, selected once per process
+    const PostprocessingKernel& selectedPostprocessingKernel();
+
+    // Every kernel the CPU can run, fastest first, ending with the scalar reference
+    std::vector<PostprocessingKernel> supportedPostprocessingKernels();
+
+    // Checks that every supported kernel finds the same candidates and computes the same IoUs
+    // as the scalar reference
+    bool verifyPostprocessingKernels();
+
+}
+
+#endif //FACE_DETECTION_POSTPROCESSINGKERNELS_H
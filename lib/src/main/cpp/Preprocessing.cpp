@@ -0,0 +1,379 @@
+//
+// Created by Jakub Dolejs on 17/07/2025.
+//
+
+#include "Preprocessing.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include "HalfFloat.h"
+
+namespace verid {
+
+    namespace {
+        constexpr float MEAN_R = 104.0f;
+        constexpr float MEAN_G = 117.0f;
+        constexpr float MEAN_B = 123.0f;
+        // Bands smaller than this cost more to hand over than to resample
+        constexpr int MIN_BAND_ROWS = 32;
+
+        inline unsigned char clampToByte(int v) {
+            return static_cast<unsigned char>(v < 0 ? 0 : (v > 255 ? 255 : v));
+        }
+
+        // Full-range BT.601 (JFIF), as produced by Android cameras, in 16.16 fixed point
+        inline void yuvToRgb(int y, int u, int v, unsigned char& r, unsigned char& g, unsigned char& b) {
+            const int d = u - 128;
+            const int e = v - 128;
+            const int yy = (y << 16) + 32768;
+            r = clampToByte((yy + 91881 * e) >> 16);
+            g = clampToByte((yy - 22554 * d - 46802 * e) >> 16);
+            b = clampToByte((yy + 116130 * d) >> 16);
+        }
+    }
+
+    Preprocessing::Preprocessing(int targetSize, WorkerPool& workerPool)
+            : targetWidth(targetSize),
+              targetHeight(targetSize),
+              workerPool(workerPool),
+              kernel(selectedPreprocessingKernel()),
+              rowBuffer(static_cast<size_t>(workerPool.parallelism()) * targetSize * 3, 0) {}
+
+    void Preprocessing::setTargetSize(int width, int height) {
+        if (width <= 0 || height <= 0)
+            throw std::invalid_argument("Invalid target size");
+        targetWidth = width;
+        targetHeight = height;
+        const size_t rowBufferSize = static_cast<size_t>(workerPool.parallelism()) * width * 3;
+        if (rowBuffer.size() < rowBufferSize) rowBuffer.resize(rowBufferSize);
+    }
+
+    InputTransform Preprocessing::preprocessBitmap(void* inputBuffer, int width, int height, int bytesPerRow, int imageFormat,
+                                                   const Region& region, const Orientation& orientation, std::vector<float>& outRGB) {
+        return resampleBitmap(inputBuffer, width, height, bytesPerRow, imageFormat, region, orientation, floatOutput(outRGB));
+    }
+
+    InputTransform Preprocessing::preprocessBitmap(void* inputBuffer, int width, int height, int bytesPerRow, int imageFormat,
+                                                   const Region& region, const Orientation& orientation, std::vector<unsigned char>& outRGB) {
+        return resampleBitmap(inputBuffer, width, height, bytesPerRow, imageFormat, region, orientation, byteOutput(outRGB));
+    }
+
+    InputTransform Preprocessing::preprocessBitmap(void* inputBuffer, int width, int height, int bytesPerRow, int imageFormat,
+                                                   const Region& region, const Orientation& orientation, std::vector<uint16_t>& outRGB) {
+        return resampleBitmap(inputBuffer, width, height, bytesPerRow, imageFormat, region, orientation, halfOutput(outRGB));
+    }
+
+    InputTransform Preprocessing::preprocessBitmap(void* inputBuffer, int width, int height, int bytesPerRow, int imageFormat,
+                                                   const Region& region, const Orientation& orientation, std::vector<int8_t>& outRGB) {
+        return resampleBitmap(inputBuffer, width, height, bytesPerRow, imageFormat, region, orientation, quantizedOutput(outRGB));
+    }
+
+    InputTransform Preprocessing::preprocessYuv(const YuvImage& image, const Region& region, const Orientation& orientation,
+                                                std::vector<float>& outRGB) {
+        return resampleYuv(image, region, orientation, floatOutput(outRGB));
+    }
+
+    InputTransform Preprocessing::preprocessYuv(const YuvImage& image, const Region& region, const Orientation& orientation,
+                                                std::vector<unsigned char>& outRGB) {
+        return resampleYuv(image, region, orientation, byteOutput(outRGB));
+    }
+
+    InputTransform Preprocessing::preprocessYuv(const YuvImage& image, const Region& region, const Orientation& orientation,
+                                                std::vector<uint16_t>& outRGB) {
+        return resampleYuv(image, region, orientation, halfOutput(outRGB));
+    }
+
+    InputTransform Preprocessing::preprocessYuv(const YuvImage& image, const Region& region, const Orientation& orientation,
+                                                std::vector<int8_t>& outRGB) {
+        return resampleYuv(image, region, orientation, quantizedOutput(outRGB));
+    }
+
+    void Preprocessing::setInputQuantization(const InputQuantization& quantization) {
+        const float means[3] = {MEAN_R, MEAN_G, MEAN_B};
+        const int low = quantization.isSigned ? -128 : 0;
+        const int high = quantization.isSigned ? 127 : 255;
+        for (int c = 0; c < 3; ++c) {
+            for (int p = 0; p < 256; ++p) {
+                // Same rounding (half to even) and saturation as QuantizeLinear
+                const float q = std::nearbyint((static_cast<float>(p) - means[c]) / quantization.scale) + static_cast<float>(quantization.zeroPoint);
+                const int v = static_cast<int>(std::min(std::max(q, static_cast<float>(low)), static_cast<float>(high)));
+                quantizationTables[c][p] = static_cast<unsigned char>(v);
+            }
+        }
+        hasInputQuantization = true;
+    }
+
+    void Preprocessing::setBatchSlot(int slot, int batchSize) {
+        if (batchSize <= 0 || slot < 0 || slot >= batchSize)
+            throw std::invalid_argument("Invalid batch slot");
+        batchSlot = slot;
+        batchSize_ = batchSize;
+    }
+
+    Preprocessing::OutputTensor Preprocessing::floatOutput(std::vector<float>& outRGB) const {
+        const size_t N = static_cast<size_t>(targetWidth) * targetHeight;
+        outRGB.resize(3 * N * batchSize_);
+        OutputTensor out;
+        out.R = outRGB.data() + 3 * N * batchSlot;
+        out.G = out.R + N;
+        out.B = out.G + N;
+        return out;
+    }
+
+    Preprocessing::OutputTensor Preprocessing::byteOutput(std::vector<unsigned char>& outRGB) const {
+        const size_t N = static_cast<size_t>(targetWidth) * targetHeight;
+        outRGB.resize(3 * N * batchSize_);
+        OutputTensor out;
+        out.rgb = outRGB.data() + 3 * N * batchSlot;
+        return out;
+    }
+
+    Preprocessing::OutputTensor Preprocessing::halfOutput(std::vector<uint16_t>& outRGB) const {
+        const size_t N = static_cast<size_t>(targetWidth) * targetHeight;
+        outRGB.resize(3 * N * batchSize_);
+        OutputTensor out;
+        out.halfR = outRGB.data() + 3 * N * batchSlot;
+        out.halfG = out.halfR + N;
+        out.halfB = out.halfG + N;
+        return out;
+    }
+
+    Preprocessing::OutputTensor Preprocessing::quantizedOutput(std::vector<int8_t>& outRGB) const {
+        if (!hasInputQuantization) {
+            throw std::logic_error("Input quantization not set");
+        }
+        const size_t N = static_cast<size_t>(targetWidth) * targetHeight;
+        outRGB.resize(3 * N * batchSize_);
+        OutputTensor out;
+        out.quantizedR = reinterpret_cast<unsigned char*>(outRGB.data()) + 3 * N * batchSlot;
+        out.quantizedG = out.quantizedR + N;
+        out.quantizedB = out.quantizedG + N;
+        return out;
+    }
+
+    InputTransform Preprocessing::resampleBitmap(void* inputBuffer, int width, int height, int bytesPerRow, int imageFormat,
+                                                 const Region& region, const Orientation& orientation, const OutputTensor& out) {
+        const int bpp = bytesPerPixel(imageFormat);
+        if (bpp == 0) throw std::runtime_error("Unsupported image format");
+        if (!inputBuffer)
+            throw std::invalid_argument("inputBuffer is null");
+        if (width <= 0 || height <= 0)
+            throw std::invalid_argument("Invalid image dimensions");
+        if (bytesPerRow < width * bpp)
+            throw std::invalid_argument("bytesPerRow too small for width");
+        validateRegion(region, width, height);
+        validateOrientation(orientation);
+        const unsigned char* src = static_cast<unsigned char*>(inputBuffer);
+        ResampleKey key;
+        key.x = region.x;
+        key.y = region.y;
+        key.width = region.width;
+        key.height = region.height;
+        key.rowStride = bytesPerRow;
+        key.pixelStride = bpp;
+        key.rotation = orientation.rotation;
+        key.mirrored = orientation.mirrored;
+        key.targetWidth = targetWidth;
+        key.targetHeight = targetHeight;
+        src += detachOrigin(key).offset;
+        const ResamplePlan& plan = planCache.planFor(key);
+        switch (static_cast<PixelFormat>(imageFormat)) {
+            case PixelFormat::RGB: resample<PixelFormat::RGB>(src, plan, out); break;
+            case PixelFormat::BGR: resample<PixelFormat::BGR>(src, plan, out); break;
+            case PixelFormat::ARGB: resample<PixelFormat::ARGB>(src, plan, out); break;
+            case PixelFormat::BGRA: resample<PixelFormat::BGRA>(src, plan, out); break;
+            case PixelFormat::ABGR: resample<PixelFormat::ABGR>(src, plan, out); break;
+            case PixelFormat::RGBA: resample<PixelFormat::RGBA>(src, plan, out); break;
+            case PixelFormat::GRAYSCALE: resample<PixelFormat::GRAYSCALE>(src, plan, out); break;
+        }
+        return transformFor(plan, region);
+    }
+
+    template<PixelFormat Format>
+    void Preprocessing::resample(const unsigned char* src, const ResamplePlan& plan, const OutputTensor& out) {
+        using Layout = PixelLayout<Format>;
+        const size_t* columns = plan.columnOffsets.data();
+        const int scaledWidth = plan.scaledWidth;
+        // Nearest neighbour resampling straight into the model input
+        workerPool.parallelFor(plan.scaledHeight, MIN_BAND_ROWS, [&](int band, int begin, int end) {
+            unsigned char* rowR = stagingRow(band);
+            unsigned char* rowG = rowR + targetWidth;
+            unsigned char* rowB = rowG + targetWidth;
+            for (int y = begin; y < end; ++y) {
+                const unsigned char* srcRow = src + plan.rowOffsets[y];
+                if constexpr (Format == PixelFormat::GRAYSCALE) {
+                    // Sample the single channel once and expand it into all three planes
+                    for (int x = 0; x < scaledWidth; ++x) {
+                        rowR[x] = srcRow[columns[x]];
+                    }
+                    writeRow(rowR, rowR, rowR, y, scaledWidth, out);
+                } else {
+                    for (int x = 0; x < scaledWidth; ++x) {
+                        const unsigned char* p = srcRow + columns[x];
+                        rowR[x] = p[Layout::r];
+                        rowG[x] = p[Layout::g];
+                        rowB[x] = p[Layout::b];
+                    }
+                    writeRow(rowR, rowG, rowB, y, scaledWidth, out);
+                }
+            }
+        });
+        padRows(plan.scaledHeight, out);
+    }
+
+    InputTransform Preprocessing::resampleYuv(const YuvImage& image, const Region& region, const Orientation& orientation,
+                                              const OutputTensor& out) {
+        if (!image.y || !image.u || !image.v)
+            throw std::invalid_argument("YUV plane is null");
+        if (image.width <= 0 || image.height <= 0)
+            throw std::invalid_argument("Invalid image dimensions");
+        if (image.yRowStride < image.width)
+            throw std::invalid_argument("Y row stride too small for width");
+        if (image.uvPixelStride < 1 || image.uvRowStride < 1)
+            throw std::invalid_argument("Invalid UV strides");
+        validateRegion(region, image.width, image.height);
+        validateOrientation(orientation);
+        ResampleKey key;
+        key.x = region.x;
+        key.y = region.y;
+        key.width = region.width;
+        key.height = region.height;
+        key.rowStride = image.yRowStride;
+        key.pixelStride = 1;
+        key.chromaRowStride = image.uvRowStride;
+        key.chromaPixelStride = image.uvPixelStride;
+        key.rotation = orientation.rotation;
+        key.mirrored = orientation.mirrored;
+        key.targetWidth = targetWidth;
+        key.targetHeight = targetHeight;
+        const ResampleOrigin origin = detachOrigin(key);
+        const unsigned char* yPlane = image.y + origin.offset;
+        const unsigned char* uPlane = image.u + origin.chromaOffset;
+        const unsigned char* vPlane = image.v + origin.chromaOffset;
+        const ResamplePlan& plan = planCache.planFor(key);
+        const size_t* columns = plan.columnOffsets.data();
+        const size_t* chromaColumns = plan.chromaColumnOffsets.data();
+        const int scaledWidth = plan.scaledWidth;
+        workerPool.parallelFor(plan.scaledHeight, MIN_BAND_ROWS, [&](int band, int begin, int end) {
+            unsigned char* rowR = stagingRow(band);
+            unsigned char* rowG = rowR + targetWidth;
+            unsigned char* rowB = rowG + targetWidth;
+            for (int y = begin; y < end; ++y) {
+                const unsigned char* yRow = yPlane + plan.rowOffsets[y];
+                const unsigned char* uRow = uPlane + plan.chromaRowOffsets[y];
+                const unsigned char* vRow = vPlane + plan.chromaRowOffsets[y];
+                for (int x = 0; x < scaledWidth; ++x) {
+                    yuvToRgb(yRow[columns[x]], uRow[chromaColumns[x]], vRow[chromaColumns[x]], rowR[x], rowG[x], rowB[x]);
+                }
+                writeRow(rowR, rowG, rowB, y, scaledWidth, out);
+            }
+        });
+        padRows(plan.scaledHeight, out);
+        return transformFor(plan, region);
+    }
+
+    void Preprocessing::writeRow(const unsigned char* rowR, const unsigned char* rowG, const unsigned char* rowB,
+                                 int y, int scaledWidth, const OutputTensor& out) const {
+        const size_t row = static_cast<size_t>(y) * targetWidth;
+        if (out.rgb) {
+            unsigned char* dst = out.rgb + row * 3;
+            for (int x = 0; x < scaledWidth; ++x) {
+                dst[0] = rowR[x];
+                dst[1] = rowG[x];
+                dst[2] = rowB[x];
+                dst += 3;
+            }
+            std::fill(dst, out.rgb + (row + targetWidth) * 3, 0);
+            return;
+        }
+        if (out.halfR) {
+            kernel.planeToHalf(rowR, out.halfR + row, scaledWidth, MEAN_R);
+            kernel.planeToHalf(rowG, out.halfG + row, scaledWidth, MEAN_G);
+            kernel.planeToHalf(rowB, out.halfB + row, scaledWidth, MEAN_B);
+            std::fill(out.halfR + row + scaledWidth, out.halfR + row + targetWidth, floatToHalf(-MEAN_R));
+            std::fill(out.halfG + row + scaledWidth, out.halfG + row + targetWidth, floatToHalf(-MEAN_G));
+            std::fill(out.halfB + row + scaledWidth, out.halfB + row + targetWidth, floatToHalf(-MEAN_B));
+            return;
+        }
+        if (out.quantizedR) {
+            const unsigned char* rows[3] = {rowR, rowG, rowB};
+            unsigned char* planes[3] = {out.quantizedR + row, out.quantizedG + row, out.quantizedB + row};
+            for (int c = 0; c < 3; ++c) {
+                const auto& table = quantizationTables[c];
+                for (int x = 0; x < scaledWidth; ++x) {
+                    planes[c][x] = table[rows[c][x]];
+                }
+                std::fill(planes[c] + scaledWidth, planes[c] + targetWidth, table[0]);
+            }
+            return;
+        }
+        kernel.planeToFloat(rowR, out.R + row, scaledWidth, MEAN_R);
+        kernel.planeToFloat(rowG, out.G + row, scaledWidth, MEAN_G);
+        kernel.planeToFloat(rowB, out.B + row, scaledWidth, MEAN_B);
+        // Padding is black before mean subtraction
+        std::fill(out.R + row + scaledWidth, out.R + row + targetWidth, -MEAN_R);
+        std::fill(out.G + row + scaledWidth, out.G + row + targetWidth, -MEAN_G);
+        std::fill(out.B + row + scaledWidth, out.B + row + targetWidth, -MEAN_B);
+    }
+
+    void Preprocessing::padRows(int scaledHeight, const OutputTensor& out) const {
+        const size_t N = static_cast<size_t>(targetWidth) * targetHeight;
+        const size_t padStart = static_cast<size_t>(scaledHeight) * targetWidth;
+        if (out.rgb) {
+            std::fill(out.rgb + padStart * 3, out.rgb + N * 3, 0);
+            return;
+        }
+        if (out.halfR) {
+            std::fill(out.halfR + padStart, out.halfR + N, floatToHalf(-MEAN_R));
+            std::fill(out.halfG + padStart, out.halfG + N, floatToHalf(-MEAN_G));
+            std::fill(out.halfB + padStart, out.halfB + N, floatToHalf(-MEAN_B));
+            return;
+        }
+        if (out.quantizedR) {
+            std::fill(out.quantizedR + padStart, out.quantizedR + N, quantizationTables[0][0]);
+            std::fill(out.quantizedG + padStart, out.quantizedG + N, quantizationTables[1][0]);
+            std::fill(out.quantizedB + padStart, out.quantizedB + N, quantizationTables[2][0]);
+            return;
+        }
+        std::fill(out.R + padStart, out.R + N, -MEAN_R);
+        std::fill(out.G + padStart, out.G + N, -MEAN_G);
+        std::fill(out.B + padStart, out.B + N, -MEAN_B);
+    }
+
+    void Preprocessing::validateRegion(const Region& region, int width, int height) {
+        if (region.width <= 0 || region.height <= 0)
+            throw std::invalid_argument("Invalid region dimensions");
+        if (region.x < 0 || region.y < 0 || region.x > width - region.width || region.y > height - region.height)
+            throw std::invalid_argument("Region exceeds image bounds");
+    }
+
+    void Preprocessing::validateOrientation(const Orientation& orientation) {
+        if (orientation.rotation != 0 && orientation.rotation != 90 && orientation.rotation != 180 && orientation.rotation != 270)
+            throw std::invalid_argument("Rotation must be 0, 90, 180 or 270 degrees");
+    }
+
+    InputTransform Preprocessing::transformFor(const ResamplePlan& plan, const Region& region) {
+        InputTransform transform;
+        transform.scale = plan.scale;
+        transform.originX = static_cast<float>(region.x);
+        transform.originY = static_cast<float>(region.y);
+        transform.regionWidth = static_cast<float>(plan.key.width);
+        transform.regionHeight = static_cast<float>(plan.key.height);
+        transform.orientation = { plan.key.rotation, plan.key.mirrored };
+        return transform;
+    }
+
+    int Preprocessing::bytesPerPixel(int format) {
+        switch (static_cast<PixelFormat>(format)) {
+            case PixelFormat::RGB: return PixelLayout<PixelFormat::RGB>::bytesPerPixel;
+            case PixelFormat::BGR: return PixelLayout<PixelFormat::BGR>::bytesPerPixel;
+            case PixelFormat::ARGB: return PixelLayout<PixelFormat::ARGB>::bytesPerPixel;
+            case PixelFormat::BGRA: return PixelLayout<PixelFormat::BGRA>::bytesPerPixel;
+            case PixelFormat::ABGR: return PixelLayout<PixelFormat::ABGR>::bytesPerPixel;
+            case PixelFormat::RGBA: return PixelLayout<PixelFormat::RGBA>::bytesPerPixel;
+            case PixelFormat::GRAYSCALE: return PixelLayout<PixelFormat::GRAYSCALE>::bytesPerPixel;
+            default: return 0;
+        }
+    }
+
+}
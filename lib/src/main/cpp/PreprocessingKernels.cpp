@@ -0,0 +1,205 @@
+#include "PreprocessingKernels.h"
+#include <cstring>
+#include "HalfFloat.h"
+#include "Logger.h"
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VERID_X86_KERNELS 1
+#endif
+
+namespace verid {
+
+    namespace {
+
+        void planeToFloatScalar(const unsigned char* src, float* dst, int count, float mean) {
+            for (int i = 0; i < count; ++i) {
+                dst[i] = static_cast<float>(src[i]) - mean;
+            }
+        }
+
+        void planeToHalfScalar(const unsigned char* src, uint16_t* dst, int count, float mean) {
+            for (int i = 0; i < count; ++i) {
+                dst[i] = floatToHalf(static_cast<float>(src[i]) - mean);
+            }
+        }
+
+#if defined(__ARM_NEON)
+        void planeToFloatNeon(const unsigned char* src, float* dst, int count, float mean) {
+            int i = 0;
+            const float32x4_t m = vdupq_n_f32(mean);
+            for (; i + 16 <= count; i += 16) {
+                uint8x16_t v = vld1q_u8(src + i);
+                uint16x8_t lo = vmovl_u8(vget_low_u8(v));
+                uint16x8_t hi = vmovl_u8(vget_high_u8(v));
+                vst1q_f32(dst + i,      vsubq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(lo))), m));
+                vst1q_f32(dst + i + 4,  vsubq_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(lo))), m));
+                vst1q_f32(dst + i + 8,  vsubq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(hi))), m));
+                vst1q_f32(dst + i + 12, vsubq_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(hi))), m));
+            }
+            planeToFloatScalar(src + i, dst + i, count - i, mean);
+        }
+
+        void planeToHalfNeon(const unsigned char* src, uint16_t* dst, int count, float mean) {
+            int i = 0;
+            const float32x4_t m = vdupq_n_f32(mean);
+            for (; i + 8 <= count; i += 8) {
+                uint16x8_t v = vmovl_u8(vld1_u8(src + i));
+                float16x4_t lo = vcvt_f16_f32(vsubq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(v))), m));
+                float16x4_t hi = vcvt_f16_f32(vsubq_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(v))), m));
+                vst1q_u16(dst + i, vreinterpretq_u16_f16(vcombine_f16(lo, hi)));
+            }
+            planeToHalfScalar(src + i, dst + i, count - i, mean);
+        }
+#endif
+
+#ifdef VERID_X86_KERNELS
+        __attribute__((target("sse2")))
+        void planeToFloatSse2(const unsigned char* src, float* dst, int count, float mean) {
+            int i = 0;
+            const __m128 m = _mm_set1_ps(mean);
+            const __m128i zero = _mm_setzero_si128();
+            for (; i + 16 <= count; i += 16) {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+                __m128i lo = _mm_unpacklo_epi8(v, zero);
+                __m128i hi = _mm_unpackhi_epi8(v, zero);
+                _mm_storeu_ps(dst + i,      _mm_sub_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), m));
+                _mm_storeu_ps(dst + i + 4,  _mm_sub_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), m));
+                _mm_storeu_ps(dst + i + 8,  _mm_sub_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), m));
+                _mm_storeu_ps(dst + i + 12, _mm_sub_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), m));
+            }
+            planeToFloatScalar(src + i, dst + i, count - i, mean);
+        }
+
+        __attribute__((target("sse4.1")))
+        void planeToFloatSse41(const unsigned char* src, float* dst, int count, float mean) {
+            int i = 0;
+            const __m128 m = _mm_set1_ps(mean);
+            for (; i + 16 <= count; i += 16) {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+                _mm_storeu_ps(dst + i,      _mm_sub_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(v)), m));
+                _mm_storeu_ps(dst + i + 4,  _mm_sub_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(v, 4))), m));
+                _mm_storeu_ps(dst + i + 8,  _mm_sub_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(v, 8))), m));
+                _mm_storeu_ps(dst + i + 12, _mm_sub_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(v, 12))), m));
+            }
+            planeToFloatScalar(src + i, dst + i, count - i, mean);
+        }
+
+        __attribute__((target("avx2")))
+        void planeToFloatAvx2(const unsigned char* src, float* dst, int count, float mean) {
+            int i = 0;
+            const __m256 m = _mm256_set1_ps(mean);
+            for (; i + 16 <= count; i += 16) {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+                _mm256_storeu_ps(dst + i,     _mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(v)), m));
+                _mm256_storeu_ps(dst + i + 8, _mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(v, 8))), m));
+            }
+            planeToFloatScalar(src + i, dst + i, count - i, mean);
+        }
+
+        __attribute__((target("avx2,f16c")))
+        void planeToHalfAvx2(const unsigned char* src, uint16_t* dst, int count, float mean) {
+            int i = 0;
+            const __m256 m = _mm256_set1_ps(mean);
+            for (; i + 8 <= count; i += 8) {
+                __m128i v = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i));
+                __m256 f = _mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(v)), m);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm256_cvtps_ph(f, _MM_FROUND_TO_NEAREST_INT));
+            }
+            planeToHalfScalar(src + i, dst + i, count - i, mean);
+        }
+
+        __attribute__((target("avx512f")))
+        void planeToFloatAvx512(const unsigned char* src, float* dst, int count, float mean) {
+            int i = 0;
+            const __m512 m = _mm512_set1_ps(mean);
+            for (; i + 16 <= count; i += 16) {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+                _mm512_storeu_ps(dst + i, _mm512_sub_ps(_mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(v)), m));
+            }
+            planeToFloatScalar(src + i, dst + i, count - i, mean);
+        }
+
+        __attribute__((target("avx512f")))
+        void planeToHalfAvx512(const unsigned char* src, uint16_t* dst, int count, float mean) {
+            int i = 0;
+            const __m512 m = _mm512_set1_ps(mean);
+            for (; i + 16 <= count; i += 16) {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+                __m512 f = _mm512_sub_ps(_mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(v)), m);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm512_cvtps_ph(f, _MM_FROUND_TO_NEAREST_INT));
+            }
+            planeToHalfScalar(src + i, dst + i, count - i, mean);
+        }
+#endif
+
+    }
+
+    std::vector<PreprocessingKernel> supportedPreprocessingKernels() {
+        std::vector<PreprocessingKernel> kernels;
+#if defined(__ARM_NEON)
+        kernels.push_back({"NEON", planeToFloatNeon, planeToHalfNeon});
+#elif defined(VERID_X86_KERNELS)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) {
+            kernels.push_back({"AVX-512", planeToFloatAvx512, planeToHalfAvx512});
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            // Without F16C the half precision conversion stays scalar
+            const bool f16c = __builtin_cpu_supports("f16c");
+            kernels.push_back({"AVX2", planeToFloatAvx2, f16c ? planeToHalfAvx2 : planeToHalfScalar});
+        }
+        if (__builtin_cpu_supports("sse4.1")) {
+            kernels.push_back({"SSE4.1", planeToFloatSse41, planeToHalfScalar});
+        }
+        if (__builtin_cpu_supports("sse2")) {
+            kernels.push_back({"SSE2", planeToFloatSse2, planeToHalfScalar});
+        }
+#endif
+        kernels.push_back({"Scalar", planeToFloatScalar, planeToHalfScalar});
+        return kernels;
+    }
+
+    const PreprocessingKernel& selectedPreprocessingKernel() {
+        static const PreprocessingKernel kernel = [] {
+            PreprocessingKernel selected = supportedPreprocessingKernels().front();
+            LOGI("Using %s preprocessing kernel", selected.name);
+            return selected;
+        }();
+        return kernel;
+    }
+
+    bool verifyPreprocessingKernels() {
+        // Every byte value at every alignment, with tail lengths either side of each vector width
+        std::vector<unsigned char> src(512 + 16);
+        for (size_t i = 0; i < src.size(); ++i) {
+            src[i] = static_cast<unsigned char>(i * 7 + 3);
+        }
+        const float means[] = {104.0f, 117.0f, 123.0f, 0.0f};
+        std::vector<float> expected(src.size());
+        std::vector<float> actual(src.size());
+        std::vector<uint16_t> expectedHalf(src.size());
+        std::vector<uint16_t> actualHalf(src.size());
+        for (const auto& kernel : supportedPreprocessingKernels()) {
+            for (int offset = 0; offset < 16; ++offset) {
+                for (int count : {0, 1, 15, 16, 17, 31, 33, 63, 64, 319, 320, 512}) {
+                    for (float mean : means) {
+                        planeToFloatScalar(src.data() + offset, expected.data(), count, mean);
+                        kernel.planeToFloat(src.data() + offset, actual.data(), count, mean);
+                        planeToHalfScalar(src.data() + offset, expectedHalf.data(), count, mean);
+                        kernel.planeToHalf(src.data() + offset, actualHalf.data(), count, mean);
+                        if (std::memcmp(expected.data(), actual.data(), count * sizeof(float)) != 0
+                            || std::memcmp(expectedHalf.data(), actualHalf.data(), count * sizeof(uint16_t)) != 0) {
+                            LOGI("%s preprocessing kernel differs from scalar reference", kernel.name);
+                            return false;
+                        }
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+}
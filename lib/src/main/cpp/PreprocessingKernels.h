@@ -0,0 +1,31 @@
+#ifndef FACE_DETECTION_PREPROCESSINGKERNELS_H
+#define FACE_DETECTION_PREPROCESSINGKERNELS_H
+
+#include <cstdint>
+#include <vector>
+
+namespace verid {
+
+    // Converts a row of 8-bit samples to float and subtracts the channel mean
+    using PlaneToFloatFn = void (*)(const unsigned char* src, float* dst, int count, float mean);
+    // Same as PlaneToFloatFn with IEEE half precision output
+    using PlaneToHalfFn = void (*)(const unsigned char* src, uint16_t* dst, int count, float mean);
+
+    struct PreprocessingKernel {
+        const char* name;
+        PlaneToFloatFn planeToFloat;
+        PlaneToHalfFn planeToHalf;
+    };
+
+    // Fastest kernel supported by the CPU, selected once per process
+    const PreprocessingKernel& selectedPreprocessingKernel();
+
+    // Every kernel the CPU can run, fastest first, ending with the scalar reference
+    std::vector<PreprocessingKernel> supportedPreprocessingKernels();
+
+    // Checks that every supported kernel produces output bit-identical to the scalar reference
+    bool verifyPreprocessingKernels();
+
+}
+
+#endif //FACE_DETECTION_PREPROCESSINGKERNELS_H
@@ -0,0 +1,84 @@
+#include "ResamplePlan.h"
+#include <algorithm>
+
+namespace verid {
+
+    ResamplePlan::ResamplePlan(const ResampleKey& key) : key(key) {
+        const bool swapAxes = key.rotation == 90 || key.rotation == 270;
+        const int uprightWidth = swapAxes ? key.height : key.width;
+        const int uprightHeight = swapAxes ? key.width : key.height;
+        // Compute scale
+        scale = std::min({1.0f, static_cast<float>(key.targetWidth) / static_cast<float>(uprightWidth),
+                          static_cast<float>(key.targetHeight) / static_cast<float>(uprightHeight)});
+        scaledWidth = static_cast<int>(static_cast<float>(uprightWidth) * scale);
+        scaledHeight = static_cast<int>(static_cast<float>(uprightHeight) * scale);
+        const bool hasChroma = key.chromaPixelStride > 0;
+        // Offsets of a sample at source column sx or source row sy
+        auto atColumn = [&](std::vector<size_t>& offsets, std::vector<size_t>& chromaOffsets, int i, int sx) {
+            offsets[i] = static_cast<size_t>(sx) * key.pixelStride;
+            if (hasChroma) chromaOffsets[i] = static_cast<size_t>(sx >> 1) * key.chromaPixelStride;
+        };
+        auto atRow = [&](std::vector<size_t>& offsets, std::vector<size_t>& chromaOffsets, int i, int sy) {
+            offsets[i] = static_cast<size_t>(sy) * key.rowStride;
+            if (hasChroma) chromaOffsets[i] = static_cast<size_t>(sy >> 1) * key.chromaRowStride;
+        };
+        columnOffsets.resize(scaledWidth);
+        if (hasChroma) chromaColumnOffsets.resize(scaledWidth);
+        for (int x = 0; x < scaledWidth; ++x) {
+            int u = static_cast<int>(static_cast<float>(x) / scale);
+            if (key.mirrored) u = uprightWidth - 1 - u;
+            switch (key.rotation) {
+                case 90: atRow(columnOffsets, chromaColumnOffsets, x, key.y + key.height - 1 - u); break;
+                case 180: atColumn(columnOffsets, chromaColumnOffsets, x, key.x + key.width - 1 - u); break;
+                case 270: atRow(columnOffsets, chromaColumnOffsets, x, key.y + u); break;
+                default: atColumn(columnOffsets, chromaColumnOffsets, x, key.x + u); break;
+            }
+        }
+        rowOffsets.resize(scaledHeight);
+        if (hasChroma) chromaRowOffsets.resize(scaledHeight);
+        for (int y = 0; y < scaledHeight; ++y) {
+            int v = static_cast<int>(static_cast<float>(y) / scale);
+            switch (key.rotation) {
+                case 90: atColumn(rowOffsets, chromaRowOffsets, y, key.x + v); break;
+                case 180: atRow(rowOffsets, chromaRowOffsets, y, key.y + key.height - 1 - v); break;
+                case 270: atColumn(rowOffsets, chromaRowOffsets, y, key.x + key.width - 1 - v); break;
+                default: atRow(rowOffsets, chromaRowOffsets, y, key.y + v); break;
+            }
+        }
+    }
+
+    ResampleOrigin detachOrigin(ResampleKey& key) {
+        const bool hasChroma = key.chromaPixelStride > 0;
+        if (hasChroma && ((key.x | key.y) & 1)) {
+            return {};
+        }
+        ResampleOrigin origin;
+        origin.offset = static_cast<size_t>(key.x) * key.pixelStride + static_cast<size_t>(key.y) * key.rowStride;
+        origin.chromaOffset = static_cast<size_t>(key.x >> 1) * key.chromaPixelStride
+            + static_cast<size_t>(key.y >> 1) * key.chromaRowStride;
+        key.x = 0;
+        key.y = 0;
+        return origin;
+    }
+
+    ResamplePlanCache::ResamplePlanCache(size_t capacity) : capacity_(std::max<size_t>(capacity, 1)) {
+        plans_.reserve(capacity_);
+    }
+
+    const ResamplePlan& ResamplePlanCache::planFor(const ResampleKey& key) {
+        auto it = std::find_if(plans_.begin(), plans_.end(),
+                               [&key](const ResamplePlan& plan) { return plan.key == key; });
+        if (it != plans_.end()) {
+            ++hits_;
+            std::rotate(plans_.begin(), it, it + 1);
+            return plans_.front();
+        }
+        ++misses_;
+        if (plans_.size() >= capacity_) {
+            plans_.pop_back();
+        }
+        plans_.emplace(plans_.begin(), key);
+        return plans_.front();
+    }
+
+}
@@ -0,0 +1,84 @@
+#ifndef FACE_DETECTION_RESAMPLEPLAN_H
+#define FACE_DETECTION_RESAMPLEPLAN_H
+
+#include <cstddef>
+#include <vector>
+
+namespace verid {
+
+    // Source geometry that determines which pixels the resampler reads
+    struct ResampleKey {
+        // Region of the source image that is resampled
+        int x = 0;
+        int y = 0;
+        int width = 0;
+        int height = 0;
+        int rowStride = 0;
+        int pixelStride = 0;
+        // Subsampled chroma planes of YUV input, zero otherwise
+        int chromaRowStride = 0;
+        int chromaPixelStride = 0;
+        // Clockwise rotation that makes the region upright, followed by an optional horizontal flip
+        int rotation = 0;
+        bool mirrored = false;
+        // Model input the upright region is scaled to fit
+        int targetWidth = 0;
+        int targetHeight = 0;
+
+        bool operator==(const ResampleKey& other) const {
+            return x == other.x && y == other.y && width == other.width && height == other.height
+                && rowStride == other.rowStride && pixelStride == other.pixelStride
+                && chromaRowStride == other.chromaRowStride && chromaPixelStride == other.chromaPixelStride
+                && rotation == other.rotation && mirrored == other.mirrored
+                && targetWidth == other.targetWidth && targetHeight == other.targetHeight;
+        }
+    };
+
+    // Where a region starts in the image and chroma planes, for keys whose origin was detached
+    struct ResampleOrigin {
+        size_t offset = 0;
+        size_t chromaOffset = 0;
+    };
+
+    // Moves the region origin out of the key so that regions of the same size share a plan,
+    // e.g. one that follows a face from frame to frame. Subsampled chroma only splits that way
+    // at even origins, so odd origins of YUV input stay in the key and the returned offsets are zero.
+    ResampleOrigin detachOrigin(ResampleKey& key);
+
+    // Precomputed nearest-neighbour source offsets for every output row and column,
+    // relative to the key's origin (the image start when it was detached). The source pixel of output
+    // (x, y) is at rowOffsets[y] + columnOffsets[x]; with a 90 or 270 degree rotation the
+    // column offsets step through source rows and the row offsets through source columns.
+    struct ResamplePlan {
+        ResampleKey key;
+        float scale = 1.0f;
+        int scaledWidth = 0;
+        int scaledHeight = 0;
+        std::vector<size_t> columnOffsets;
+        std::vector<size_t> rowOffsets;
+        std::vector<size_t> chromaColumnOffsets;
+        std::vector<size_t> chromaRowOffsets;
+
+        explicit ResamplePlan(const ResampleKey& key);
+    };
+
+    class ResamplePlanCache {
+    public:
+        explicit ResamplePlanCache(size_t capacity = 4);
+
+        const ResamplePlan& planFor(const ResampleKey& key);
+
+        [[nodiscard]] size_t hits() const { return hits_; }
+        [[nodiscard]] size_t misses() const { return misses_; }
+
+    private:
+        size_t capacity_;
+        // Most recently used first
+        std::vector<ResamplePlan> plans_;
+        size_t hits_ = 0;
+        size_t misses_ = 0;
+    };
+
+}
+
+#endif //FACE_DETECTION_RESAMPLEPLAN_H
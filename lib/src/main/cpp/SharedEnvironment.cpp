@@ -0,0 +1,108 @@
+#include "SharedEnvironment.h"
+#include <algorithm>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <onnxruntime/core/session/onnxruntime_session_options_config_keys.h>
+#include "Logger.h"
+
+namespace verid {
+
+    namespace {
+        std::mutex environmentMutex;
+        std::weak_ptr<Ort::Env> sharedEnvironment;
+        ThreadPoolOptions poolOptions;
+        // Threading of the environment in use, which sessions created on it follow
+        ThreadPoolOptions environmentPool;
+        bool environmentHasGlobalPools = false;
+
+        int poolThreads(const ThreadPoolOptions &options) {
+            if (options.threads > 0) return options.threads;
+            return static_cast<int>(std::clamp(std::thread::hardware_concurrency(), 1u, 4u));
+        }
+
+        // ONNX Runtime hands out the process's existing environment, with the threading it was created
+        // with, if another component created one first. Only a session without threads of its own
+        // tells whether that environment has global pools, so one is created for a one-node model.
+        bool hasGlobalThreadPools(const Ort::Env &environment) {
+            try {
+                Ort::TensorTypeAndShapeInfo tensorInfo(ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT, std::vector<int64_t>{1});
+                Ort::TypeInfo typeInfo = Ort::TypeInfo::CreateTensorInfo(tensorInfo.GetConst());
+                std::vector<Ort::ValueInfo> inputs;
+                inputs.emplace_back("x", typeInfo.GetConst());
+                std::vector<Ort::ValueInfo> outputs;
+                outputs.emplace_back("y", typeInfo.GetConst());
+                Ort::Graph graph;
+                graph.SetInputs(inputs);
+                graph.SetOutputs(outputs);
+                Ort::Node identity("Identity", "", "identity", {"x"}, {"y"});
+                graph.AddNode(identity);
+                Ort::Model model({{"", 13}});
+                model.AddGraph(graph);
+                Ort::SessionOptions options;
+                options.DisablePerSessionThreads();
+                Ort::Session session(environment, model, options);
+                return true;
+            } catch (const Ort::Exception &e) {
+                LOGI("Environment has no global thread pools, sessions get their own: %s", e.what());
+                return false;
+            }
+        }
+    }
+
+    std::shared_ptr<Ort::Env> acquireEnvironment() {
+        std::lock_guard<std::mutex> lock(environmentMutex);
+        if (auto environment = sharedEnvironment.lock()) {
+            return environment;
+        }
+        const int threads = poolThreads(poolOptions);
+        Ort::ThreadingOptions threading;
+        threading.SetGlobalIntraOpNumThreads(threads);
+        // Sessions run their nodes sequentially, so the inter-op pool is never used
+        threading.SetGlobalInterOpNumThreads(1);
+        threading.SetGlobalSpinControl(poolOptions.allowSpinning ? 1 : 0);
+        auto environment = std::make_shared<Ort::Env>(threading, ORT_LOGGING_LEVEL_WARNING, LOG_TAG);
+        LOGI("Created environment with %d intra-op threads, spinning %s", threads, poolOptions.allowSpinning ? "on" : "off");
+        environmentPool = {threads, poolOptions.allowSpinning};
+        environmentHasGlobalPools = hasGlobalThreadPools(*environment);
+        sharedEnvironment = environment;
+        return environment;
+    }
+
+    void setThreadPoolOptions(const ThreadPoolOptions &options) {
+        if (options.threads > 64) {
+            throw std::invalid_argument("Thread pool too large");
+        }
+        std::lock_guard<std::mutex> lock(environmentMutex);
+        poolOptions = options;
+    }
+
+    ThreadPoolOptions threadPoolOptions() {
+        std::lock_guard<std::mutex> lock(environmentMutex);
+        return poolOptions;
+    }
+
+    ThreadPoolOptions environmentThreadPool() {
+        std::lock_guard<std::mutex> lock(environmentMutex);
+        return environmentPool;
+    }
+
+    bool environmentHasGlobalThreadPools() {
+        std::lock_guard<std::mutex> lock(environmentMutex);
+        return environmentHasGlobalPools;
+    }
+
+    Ort::SessionOptions &useEnvironmentThreadPools(Ort::SessionOptions &options) {
+        std::lock_guard<std::mutex> lock(environmentMutex);
+        if (environmentHasGlobalPools) {
+            options.DisablePerSessionThreads();
+        } else {
+            options.SetIntraOpNumThreads(environmentPool.threads);
+            options.SetInterOpNumThreads(1);
+            options.AddConfigEntry(kOrtSessionOptionsConfigAllowIntraOpSpinning, environmentPool.allowSpinning ? "1" : "0");
+        }
+        return options;
+    }
+
+}
@@ -0,0 +1,35 @@
+#ifndef FACE_DETECTION_SHAREDENVIRONMENT_H
+#define FACE_DETECTION_SHAREDENVIRONMENT_H
+
+#include <memory>
+#include <onnxruntime/core/session/onnxruntime_cxx_api.h>
+
+namespace verid {
+
+    // Global intra-op pool that every session of the process runs on
+    struct ThreadPoolOptions {
+        // Threads of the pool, the calling thread included; 0 or less picks the number of cores, capped at 4
+        int threads = 0;
+        // Idle threads spin briefly before sleeping, which shortens the start of each run at the cost of CPU time
+        bool allowSpinning = true;
+    };
+
+    // ONNX Runtime allows one environment per process. It is created with global thread pools by
+    // the first caller and released with the last reference.
+    std::shared_ptr<Ort::Env> acquireEnvironment();
+
+    // Pool used by the environment created next. An environment in use keeps its pool until it is released.
+    void setThreadPoolOptions(const ThreadPoolOptions &options);
+    ThreadPoolOptions threadPoolOptions();
+
+    // Pool of the environment created last and whether its sessions share it, as opposed to each having one like it
+    ThreadPoolOptions environmentThreadPool();
+    bool environmentHasGlobalThreadPools();
+
+    // Makes sessions created with the options run on the acquired environment's global pools. An environment
+    // another component created without them gives each session an intra-op pool of the configured size instead.
+    Ort::SessionOptions &useEnvironmentThreadPools(Ort::SessionOptions &options);
+
+}
+
+#endif //FACE_DETECTION_SHAREDENVIRONMENT_H
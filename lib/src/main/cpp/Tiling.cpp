@@ -0,0 +1,62 @@
+#include "Tiling.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace verid {
+
+    namespace {
+        // Tile origins spread evenly so the first and last tile touch the image edges
+        void addTilePositions(int length, int tileLength, float overlap, std::vector<int>& positions) {
+            positions.clear();
+            if (tileLength >= length) {
+                positions.push_back(0);
+                return;
+            }
+            const float stride = static_cast<float>(tileLength) * (1.0f - overlap);
+            const int count = static_cast<int>(std::ceil(static_cast<float>(length - tileLength) / stride)) + 1;
+            for (int i = 0; i < count; ++i) {
+                positions.push_back(static_cast<int>(std::lround(static_cast<double>(i) * (length - tileLength) / (count - 1))));
+            }
+        }
+
+        // Tolerance in source pixels for a box touching a tile edge
+        constexpr float EDGE_MARGIN = 2.0f;
+    }
+
+    std::vector<Region> tileRegions(int width, int height, int tileSize, const TilingOptions& options) {
+        if (width <= 0 || height <= 0)
+            throw std::invalid_argument("Invalid image dimensions");
+        if (options.scales < 1 || options.maxTiles < 1)
+            throw std::invalid_argument("Tiling needs at least one scale and one tile");
+        if (options.overlap < 0.0f || options.overlap >= 1.0f)
+            throw std::invalid_argument("Tile overlap must be in [0, 1)");
+        std::vector<Region> tiles{{0, 0, width, height}};
+        std::vector<int> columns, rows;
+        int side = std::max(width, height);
+        for (int scale = 1; scale < options.scales; ++scale) {
+            // Tiles smaller than the model input would only be upscaled
+            if (side <= tileSize) break;
+            side = std::max(side / 2, tileSize);
+            const int tileWidth = std::min(side, width);
+            const int tileHeight = std::min(side, height);
+            addTilePositions(width, tileWidth, options.overlap, columns);
+            addTilePositions(height, tileHeight, options.overlap, rows);
+            if (tiles.size() + columns.size() * rows.size() > static_cast<size_t>(options.maxTiles)) break;
+            for (int y : rows) {
+                for (int x : columns) {
+                    tiles.push_back({x, y, tileWidth, tileHeight});
+                }
+            }
+        }
+        return tiles;
+    }
+
+    bool isCutByTileEdge(const Rect& box, const Region& tile, int width, int height) {
+        return (tile.x > 0 && box.x <= tile.x + EDGE_MARGIN) ||
+               (tile.y > 0 && box.y <= tile.y + EDGE_MARGIN) ||
+               (tile.x + tile.width < width && box.x + box.width >= tile.x + tile.width - EDGE_MARGIN) ||
+               (tile.y + tile.height < height && box.y + box.height >= tile.y + tile.height - EDGE_MARGIN);
+    }
+
+}
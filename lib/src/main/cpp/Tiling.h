@@ -0,0 +1,31 @@
+#ifndef FACE_DETECTION_TILING_H
+#define FACE_DETECTION_TILING_H
+
+#include <vector>
+#include "InputTransform.h"
+
+namespace verid {
+
+    // Covers a large image with overlapping tiles so that small faces are detected closer to
+    // their full resolution than when the whole image is scaled to the model input
+    struct TilingOptions {
+        // Number of tile scales. The first is the whole image and each following one
+        // halves the tile size, down to the model input size.
+        int scales = 2;
+        // Fraction of a tile shared with its neighbours. Faces smaller than the overlap
+        // always lie entirely inside some tile of their scale.
+        float overlap = 0.25f;
+        // Scales that would take the total past this number of tiles are left out
+        int maxTiles = 16;
+    };
+
+    // Tiles, coarsest scale first, for an image of the given size
+    std::vector<Region> tileRegions(int width, int height, int tileSize, const TilingOptions& options);
+
+    // Whether the box reaches an edge of the tile that lies inside the image. Such a face is
+    // cut off and is found whole in a neighbouring tile or at a coarser scale.
+    bool isCutByTileEdge(const Rect& box, const Region& tile, int width, int height);
+
+}
+
+#endif //FACE_DETECTION_TILING_H
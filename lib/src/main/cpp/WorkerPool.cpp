@@ -0,0 +1,97 @@
+#include "WorkerPool.h"
+#include <algorithm>
+
+namespace verid {
+
+    WorkerPool::WorkerPool(int parallelism) {
+        if (parallelism <= 0) {
+            parallelism = std::min(static_cast<int>(std::thread::hardware_concurrency()), 4);
+        }
+        parallelism_ = std::max(parallelism, 1);
+        threads_.reserve(parallelism_ - 1);
+        for (int i = 1; i < parallelism_; ++i) {
+            threads_.emplace_back(&WorkerPool::workerLoop, this);
+        }
+    }
+
+    WorkerPool::~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    void WorkerPool::parallelFor(int count, int minBandSize, const BandFn& fn) {
+        if (count <= 0) return;
+        const int bands = std::clamp(count / std::max(minBandSize, 1), 1, parallelism_);
+        if (bands == 1) {
+            fn(0, 0, count);
+            return;
+        }
+        std::lock_guard<std::mutex> run(runMutex_);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            task_ = &fn;
+            count_ = count;
+            bandCount_ = bands;
+            nextBand_.store(0);
+            remainingBands_ = bands;
+            error_ = nullptr;
+            ++generation_;
+        }
+        wake_.notify_all();
+        runBands();
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this] { return remainingBands_ == 0 && activeWorkers_ == 0; });
+        task_ = nullptr;
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
+    }
+
+    void WorkerPool::workerLoop() {
+        unsigned long seenGeneration = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [&] { return stop_ || generation_ != seenGeneration; });
+                if (stop_) return;
+                seenGeneration = generation_;
+                if (task_ == nullptr) continue;
+                ++activeWorkers_;
+            }
+            runBands();
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                --activeWorkers_;
+            }
+            done_.notify_one();
+        }
+    }
+
+    void WorkerPool::runBands() {
+        while (true) {
+            const int band = nextBand_.fetch_add(1);
+            if (band >= bandCount_) return;
+            const int begin = static_cast<int>(static_cast<long long>(count_) * band / bandCount_);
+            const int end = static_cast<int>(static_cast<long long>(count_) * (band + 1) / bandCount_);
+            try {
+                (*task_)(band, begin, end);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (!error_) error_ = std::current_exception();
+            }
+            bool last;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                last = --remainingBands_ == 0;
+            }
+            if (last) done_.notify_one();
+        }
+    }
+
+}
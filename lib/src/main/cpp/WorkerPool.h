@@ -0,0 +1,73 @@
+#ifndef FACE_DETECTION_WORKERPOOL_H
+#define FACE_DETECTION_WORKERPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace verid {
+
+    // Persistent threads that split a range into contiguous bands. The calling thread
+    // works on the first band, so a pool with parallelism 1 runs no threads at all.
+    class WorkerPool {
+    public:
+        // Non-owning reference to the function run on each band. Unlike std::function it never
+        // allocates, however many variables the lambda captures; the function must outlive the call.
+        class BandFn {
+        public:
+            template<typename Fn, typename = std::enable_if_t<!std::is_same_v<std::decay_t<Fn>, BandFn>>>
+            BandFn(Fn &&fn) // NOLINT(google-explicit-constructor)
+                    : fn_(const_cast<void*>(static_cast<const void*>(std::addressof(fn)))),
+                      invoke_([](void* f, int band, int begin, int end) {
+                          (*static_cast<std::remove_reference_t<Fn>*>(f))(band, begin, end);
+                      }) {}
+
+            void operator()(int band, int begin, int end) const { invoke_(fn_, band, begin, end); }
+
+        private:
+            void* fn_;
+            void (*invoke_)(void* fn, int band, int begin, int end);
+        };
+
+        // Parallelism of 0 or less picks the number of cores, capped at 4
+        explicit WorkerPool(int parallelism);
+        ~WorkerPool();
+
+        WorkerPool(const WorkerPool&) = delete;
+        WorkerPool& operator=(const WorkerPool&) = delete;
+
+        [[nodiscard]] int parallelism() const { return parallelism_; }
+
+        // Runs fn over [0, count) in at most parallelism() bands of at least minBandSize
+        // items and blocks until every band completes. Rethrows the first exception thrown by fn.
+        void parallelFor(int count, int minBandSize, const BandFn& fn);
+
+    private:
+        int parallelism_;
+        std::vector<std::thread> threads_;
+        std::mutex runMutex_;
+        std::mutex mutex_;
+        std::condition_variable wake_;
+        std::condition_variable done_;
+        const BandFn* task_ = nullptr;
+        int count_ = 0;
+        int bandCount_ = 0;
+        std::atomic<int> nextBand_{0};
+        int remainingBands_ = 0;
+        int activeWorkers_ = 0;
+        unsigned long generation_ = 0;
+        bool stop_ = false;
+        std::exception_ptr error_;
+
+        void workerLoop();
+        void runBands();
+    };
+
+}
+
+#endif //FACE_DETECTION_WORKERPOOL_H
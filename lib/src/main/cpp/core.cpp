@@ -5,9 +5,15 @@
 #include <cmath>
 #include <stdexcept>
 #include <tuple>
+#include "AllocationCounter.h"
 #include "FaceDetection.h"
+#include "NonMaxSuppression.h"
 #include <onnxruntime/core/providers/nnapi/nnapi_provider_factory.h>
 #include "OptimalSessionSettingsSelector.h"
+#include "Postprocessing.h"
+#include "PostprocessingKernels.h"
+#include "PreprocessingKernels.h"
+#include "SharedEnvironment.h"
 
 extern "C"
 JNIEXPORT jlong JNICALL
@@ -16,14 +22,15 @@ Java_com_appliedrec_verid3_facedetection_retinaface_FaceDetectionRetinaFace_crea
     jobject thiz,
     jstring model_file,
     jboolean useNnapi,
-    jint nnapiFlags
+    jint nnapiFlags,
+    jint parallelism,
+    jint inputFormat
 ) {
     try {
         const char *modelPathCStr = env->GetStringUTFChars(model_file, nullptr);
         std::string modelPath(modelPathCStr);
         env->ReleaseStringUTFChars(model_file, modelPathCStr);
         Ort::SessionOptions sessionOptions;
-        sessionOptions.SetIntraOpNumThreads(1);
         sessionOptions.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_EXTENDED);
         sessionOptions.SetLogSeverityLevel(ORT_LOGGING_LEVEL_WARNING);
         if (useNnapi) {
@@ -37,13 +44,39 @@ Java_com_appliedrec_verid3_facedetection_retinaface_FaceDetectionRetinaFace_crea
                 throw std::runtime_error(std::string("NNAPI setup error: ") + msg);
             }
         }
-        auto *detection = new verid::FaceDetection(modelPath, std::move(sessionOptions));
+        auto *detection = new verid::FaceDetection(modelPath, std::move(sessionOptions), parallelism,
+                                                   static_cast<verid::InputFormat>(inputFormat));
         return reinterpret_cast<jlong>(detection);
     } catch (const std::exception& e) {
         env->ThrowNew(env->FindClass("java/lang/Exception"), e.what());
         return -1L;
     }
 }
+extern "C"
+JNIEXPORT void JNICALL
+Java_com_appliedrec_verid3_facedetection_retinaface_FaceDetectionRetinaFace_00024Companion_setThreadPoolOptions(
+        JNIEnv *env, jobject thiz, jint threads, jboolean allowSpinning) {
+    try {
+        verid::setThreadPoolOptions({threads, allowSpinning == JNI_TRUE});
+    } catch (const std::exception& e) {
+        env->ThrowNew(env->FindClass("java/lang/Exception"), e.what());
+    }
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_com_appliedrec_verid3_facedetection_retinaface_FaceDetectionRetinaFace_00024Companion_environmentThreads(
+        JNIEnv *env, jobject thiz) {
+    return static_cast<jint>(verid::environmentThreadPool().threads);
+}
+
+extern "C"
+JNIEXPORT jboolean JNICALL
+Java_com_appliedrec_verid3_facedetection_retinaface_FaceDetectionRetinaFace_00024Companion_environmentHasGlobalThreadPools(
+        JNIEnv *env, jobject thiz) {
+    return verid::environmentHasGlobalThreadPools() ? JNI_TRUE : JNI_FALSE;
+}
+
 extern "C"
 JNIEXPORT void JNICALL
 Java_com_appliedrec_verid3_facedetection_retinaface_FaceDetectionRetinaFace_destroyNativeContext(
@@ -66,6 +99,15 @@ Java_com_appliedrec_verid3_facedetection_retinaface_FaceDetectionRetinaFace_dete
     jint height,
     jint bytesPerRow,
     jint imageFormat,
+    jint regionX,
+    jint regionY,
+    jint regionWidth,
+    jint regionHeight,
+    jint rotation,
+    jboolean mirrored,
+    jint inputWidth,
+    jint inputHeight,
+    jboolean matchAspectRatio,
     jint limit,
     jobject buffer
 ) {
@@ -86,14 +128,320 @@ Java_com_appliedrec_verid3_facedetection_retinaface_FaceDetectionRetinaFace_dete
         if (bufferCapacity < limit * 18 * sizeof(float)) {
             throw std::runtime_error("Output buffer too small");
         }
-        int numFaces = detection->detectFaces(in, width, height, bytesPerRow, imageFormat, limit,
-                                              out);
+        verid::Region region{regionX, regionY, regionWidth, regionHeight};
+        verid::Orientation orientation{rotation, mirrored == JNI_TRUE};
+        verid::InputSize inputSize{inputWidth, inputHeight, matchAspectRatio == JNI_TRUE};
+        int numFaces = detection->detectFaces(in, width, height, bytesPerRow, imageFormat, region,
+                                              orientation, inputSize, limit, out);
         return numFaces;
     } catch (const std::exception& e) {
         env->ThrowNew(env->FindClass("java/lang/Exception"), e.what());
         return 0;
     }
 }
+extern "C"
+JNIEXPORT jint JNICALL
+Java_com_appliedrec_verid3_facedetection_retinaface_FaceDetectionRetinaFace_detectFacesInTiles(JNIEnv *env,
+    jobject thiz,
+    jlong context,
+    jobject imageBuffer,
+    jint width,
+    jint height,
+    jint bytesPerRow,
+    jint imageFormat,
+    jint rotation,
+    jboolean mirrored,
+    jint scales,
+    jfloat overlap,
+    jint maxTiles,
+    jint limit,
+    jobject buffer
+) {
+    try {
+        auto *detection = reinterpret_cast<verid::FaceDetection *>(context);
+        if (!detection) {
+            throw std::runtime_error("Invalid context");
+        }
+        void *in = env->GetDirectBufferAddress(imageBuffer);
+        if (!in) {
+            return 0;
+        }
+        auto *out = static_cast<float *>(env->GetDirectBufferAddress(buffer));
+        if (!out) {
+            return 0;
+        }
+        jsize bufferCapacity = env->GetDirectBufferCapacity(buffer);
+        if (bufferCapacity < limit * 18 * sizeof(float)) {
+            throw std::runtime_error("Output buffer too small");
+        }
+        verid::Orientation orientation{rotation, mirrored == JNI_TRUE};
+        verid::TilingOptions tiling{scales, overlap, maxTiles};
+        return detection->detectFacesInTiles(in, width, height, bytesPerRow, imageFormat, orientation,
+                                             tiling, limit, out);
+    } catch (const std::exception& e) {
+        env->ThrowNew(env->FindClass("java/lang/Exception"), e.what());
+        return 0;
+    }
+}
+extern "C"
+JNIEXPORT void JNICALL
+Java_com_appliedrec_verid3_facedetection_retinaface_FaceDetectionRetinaFace_detectFacesInBuffers(JNIEnv *env,
+    jobject thiz,
+    jlong context,
+    jobjectArray imageBuffers,
+    jintArray widths,
+    jintArray heights,
+    jintArray bytesPerRow,
+    jintArray imageFormats,
+    jint rotation,
+    jboolean mirrored,
+    jint limit,
+    jobject buffer,
+    jintArray counts
+) {
+    try {
+        auto *detection = reinterpret_cast<verid::FaceDetection *>(context);
+        if (!detection) {
+            throw std::runtime_error("Invalid context");
+        }
+        const jsize count = env->GetArrayLength(imageBuffers);
+        if (env->GetArrayLength(widths) != count || env->GetArrayLength(heights) != count ||
+            env->GetArrayLength(bytesPerRow) != count || env->GetArrayLength(imageFormats) != count ||
+            env->GetArrayLength(counts) != count) {
+            throw std::invalid_argument("Image arrays differ in length");
+        }
+        auto *out = static_cast<float *>(env->GetDirectBufferAddress(buffer));
+        if (!out) {
+            throw std::runtime_error("Output buffer is not direct");
+        }
+        jlong bufferCapacity = env->GetDirectBufferCapacity(buffer);
+        if (bufferCapacity < static_cast<jlong>(count) * limit * 18 * sizeof(float)) {
+            throw std::runtime_error("Output buffer too small");
+        }
+        std::vector<jint> width(count), height(count), stride(count), format(count);
+        env->GetIntArrayRegion(widths, 0, count, width.data());
+        env->GetIntArrayRegion(heights, 0, count, height.data());
+        env->GetIntArrayRegion(bytesPerRow, 0, count, stride.data());
+        env->GetIntArrayRegion(imageFormats, 0, count, format.data());
+        std::vector<verid::BatchImage> images(count);
+        for (jsize i = 0; i < count; ++i) {
+            jobject imageBuffer = env->GetObjectArrayElement(imageBuffers, i);
+            images[i].data = env->GetDirectBufferAddress(imageBuffer);
+            env->DeleteLocalRef(imageBuffer);
+            if (!images[i].data) {
+                throw std::runtime_error("Image buffer is not direct");
+            }
+            images[i].width = width[i];
+            images[i].height = height[i];
+            images[i].bytesPerRow = stride[i];
+            images[i].format = format[i];
+            images[i].orientation = verid::Orientation{rotation, mirrored == JNI_TRUE};
+        }
+        std::vector<jint> faceCounts(count);
+        detection->detectFacesInBatch(images.data(), count, limit, out, faceCounts.data());
+        env->SetIntArrayRegion(counts, 0, count, faceCounts.data());
+    } catch (const std::exception& e) {
+        env->ThrowNew(env->FindClass("java/lang/Exception"), e.what());
+    }
+}
+extern "C"
+JNIEXPORT jint JNICALL
+Java_com_appliedrec_verid3_facedetection_retinaface_FaceDetectionRetinaFace_detectFacesInYuvBuffers(JNIEnv *env,
+    jobject thiz,
+    jlong context,
+    jobject yBuffer,
+    jobject uBuffer,
+    jobject vBuffer,
+    jint width,
+    jint height,
+    jint yRowStride,
+    jint uvRowStride,
+    jint uvPixelStride,
+    jint regionX,
+    jint regionY,
+    jint regionWidth,
+    jint regionHeight,
+    jint rotation,
+    jboolean mirrored,
+    jint inputWidth,
+    jint inputHeight,
+    jboolean matchAspectRatio,
+    jint limit,
+    jobject buffer
+) {
+    try {
+        auto *detection = reinterpret_cast<verid::FaceDetection *>(context);
+        if (!detection) {
+            throw std::runtime_error("Invalid context");
+        }
+        verid::YuvImage image{};
+        image.y = static_cast<const unsigned char *>(env->GetDirectBufferAddress(yBuffer));
+        image.u = static_cast<const unsigned char *>(env->GetDirectBufferAddress(uBuffer));
+        image.v = static_cast<const unsigned char *>(env->GetDirectBufferAddress(vBuffer));
+        if (!image.y || !image.u || !image.v) {
+            return 0;
+        }
+        image.width = width;
+        image.height = height;
+        image.yRowStride = yRowStride;
+        image.uvRowStride = uvRowStride;
+        image.uvPixelStride = uvPixelStride;
+        auto *out = static_cast<float *>(env->GetDirectBufferAddress(buffer));
+        if (!out) {
+            return 0;
+        }
+        jsize bufferCapacity = env->GetDirectBufferCapacity(buffer);
+        if (bufferCapacity < limit * 18 * sizeof(float)) {
+            throw std::runtime_error("Output buffer too small");
+        }
+        verid::Region region{regionX, regionY, regionWidth, regionHeight};
+        verid::Orientation orientation{rotation, mirrored == JNI_TRUE};
+        verid::InputSize inputSize{inputWidth, inputHeight, matchAspectRatio == JNI_TRUE};
+        return detection->detectFaces(image, region, orientation, inputSize, limit, out);
+    } catch (const std::exception& e) {
+        env->ThrowNew(env->FindClass("java/lang/Exception"), e.what());
+        return 0;
+    }
+}
+extern "C"
+JNIEXPORT jint JNICALL
+Java_com_appliedrec_verid3_facedetection_retinaface_FaceDetectionRetinaFace_modelInputFormat(
+        JNIEnv *env, jobject thiz, jlong context) {
+    auto *detection = reinterpret_cast<verid::FaceDetection *>(context);
+    return static_cast<jint>(detection->inputFormat());
+}
+
+extern "C"
+JNIEXPORT jboolean JNICALL
+Java_com_appliedrec_verid3_facedetection_retinaface_FaceDetectionRetinaFace_hasDynamicInputSize(
+        JNIEnv *env, jobject thiz, jlong context) {
+    auto *detection = reinterpret_cast<verid::FaceDetection *>(context);
+    return static_cast<jboolean>(detection->hasDynamicInputSize());
+}
+
+extern "C"
+JNIEXPORT jlong JNICALL
+Java_com_appliedrec_verid3_facedetection_retinaface_FaceDetectionRetinaFace_detectionAllocations(
+        JNIEnv *env, jobject thiz, jlong context) {
+    if (!verid::isCountingAllocations()) {
+        return -1;
+    }
+    auto *detection = reinterpret_cast<verid::FaceDetection *>(context);
+    return static_cast<jlong>(detection->detectionAllocations());
+}
+
+extern "C"
+JNIEXPORT jlong JNICALL
+Java_com_appliedrec_verid3_facedetection_retinaface_FaceDetectionRetinaFace_environmentHandle(
+        JNIEnv *env, jobject thiz, jlong context) {
+    auto *detection = reinterpret_cast<verid::FaceDetection *>(context);
+    return reinterpret_cast<jlong>(detection->environment());
+}
+
+extern "C"
+JNIEXPORT jlong JNICALL
+Java_com_appliedrec_verid3_facedetection_retinaface_FaceDetectionRetinaFace_planCacheHits(
+        JNIEnv *env, jobject thiz, jlong context) {
+    auto *detection = reinterpret_cast<verid::FaceDetection *>(context);
+    return static_cast<jlong>(detection->planCacheHits());
+}
+
+extern "C"
+JNIEXPORT jlong JNICALL
+Java_com_appliedrec_verid3_facedetection_retinaface_FaceDetectionRetinaFace_planCacheMisses(
+        JNIEnv *env, jobject thiz, jlong context) {
+    auto *detection = reinterpret_cast<verid::FaceDetection *>(context);
+    return static_cast<jlong>(detection->planCacheMisses());
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_com_appliedrec_verid3_facedetection_retinaface_FaceDetectionRetinaFace_setDetectionFilter(
+        JNIEnv *env, jobject thiz, jlong context, jfloat scoreThreshold, jfloat minFaceSize, jfloat maxFaceSize) {
+    try {
+        auto *detection = reinterpret_cast<verid::FaceDetection *>(context);
+        if (!detection) {
+            throw std::runtime_error("Invalid context");
+        }
+        detection->setDetectionFilter({scoreThreshold, minFaceSize, maxFaceSize});
+    } catch (const std::exception& e) {
+        env->ThrowNew(env->FindClass("java/lang/Exception"), e.what());
+    }
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_com_appliedrec_verid3_facedetection_retinaface_FaceDetectionRetinaFace_setSuppression(
+        JNIEnv *env, jobject thiz, jlong context, jint mode, jfloat iouThreshold, jfloat sigma) {
+    try {
+        auto *detection = reinterpret_cast<verid::FaceDetection *>(context);
+        if (!detection) {
+            throw std::runtime_error("Invalid context");
+        }
+        if (mode < 0 || mode > static_cast<jint>(verid::SuppressionMode::PEAKS)) {
+            throw std::invalid_argument("Unknown suppression mode");
+        }
+        verid::SuppressionOptions options;
+        options.mode = static_cast<verid::SuppressionMode>(mode);
+        options.iouThreshold = iouThreshold;
+        options.sigma = sigma;
+        detection->setSuppression(options);
+    } catch (const std::exception& e) {
+        env->ThrowNew(env->FindClass("java/lang/Exception"), e.what());
+    }
+}
+
+extern "C"
+JNIEXPORT jstring JNICALL
+Java_com_appliedrec_verid3_facedetection_retinaface_FaceDetectionRetinaFace_preprocessingKernelName(
+        JNIEnv *env, jobject thiz) {
+    return env->NewStringUTF(verid::selectedPreprocessingKernel().name);
+}
+
+extern "C"
+JNIEXPORT jboolean JNICALL
+Java_com_appliedrec_verid3_facedetection_retinaface_FaceDetectionRetinaFace_verifyPreprocessingKernels(
+        JNIEnv *env, jobject thiz) {
+    return static_cast<jboolean>(verid::verifyPreprocessingKernels());
+}
+
+extern "C"
+JNIEXPORT jstring JNICALL
+Java_com_appliedrec_verid3_facedetection_retinaface_FaceDetectionRetinaFace_postprocessingKernelName(
+        JNIEnv *env, jobject thiz) {
+    return env->NewStringUTF(verid::selectedPostprocessingKernel().name);
+}
+
+extern "C"
+JNIEXPORT jboolean JNICALL
+Java_com_appliedrec_verid3_facedetection_retinaface_FaceDetectionRetinaFace_verifyPostprocessingKernels(
+        JNIEnv *env, jobject thiz) {
+    return static_cast<jboolean>(verid::verifyPostprocessingKernels());
+}
+
+extern "C"
+JNIEXPORT jboolean JNICALL
+Java_com_appliedrec_verid3_facedetection_retinaface_FaceDetectionRetinaFace_verifyPriorTables(
+        JNIEnv *env, jobject thiz) {
+    return static_cast<jboolean>(verid::verifyPriorTables());
+}
+
+extern "C"
+JNIEXPORT jboolean JNICALL
+Java_com_appliedrec_verid3_facedetection_retinaface_FaceDetectionRetinaFace_verifyNonMaxSuppression(
+        JNIEnv *env, jobject thiz) {
+    return static_cast<jboolean>(verid::verifyNonMaxSuppression());
+}
+
+extern "C"
+JNIEXPORT jdouble JNICALL
+Java_com_appliedrec_verid3_facedetection_retinaface_FaceDetectionRetinaFace_benchmarkNonMaxSuppression(
+        JNIEnv *env, jobject thiz, jint candidateCount, jint mode, jint iterations) {
+    verid::SuppressionOptions options;
+    options.mode = static_cast<verid::SuppressionMode>(mode);
+    return verid::benchmarkNonMaxSuppression(candidateCount, options, iterations);
+}
+
 extern "C"
 JNIEXPORT jobject JNICALL
 Java_com_appliedrec_verid3_facedetection_retinaface_SessionConfigurationManager_calculateOptimalSessionConfiguration(
@@ -1,7 +1,9 @@
 package com.appliedrec.verid3.facedetection.retinaface
 
 import android.content.Context
+import android.graphics.ImageFormat
 import android.graphics.PointF
+import android.graphics.Rect
 import android.graphics.RectF
 import com.appliedrec.verid3.common.EulerAngle
 import com.appliedrec.verid3.common.Face
@@ -18,7 +20,6 @@ import java.util.concurrent.CompletableFuture
 import java.util.concurrent.locks.ReentrantLock
 import kotlin.concurrent.withLock
 import kotlin.jvm.Throws
-import kotlin.math.max
 
 /**
  * Face detection using RetinaFace model.
@@ -32,11 +33,22 @@ import kotlin.math.max
  * @param modelVariant Model file variant.
  * @param useNnapi `true` to use NNAPI for inference.
  * @param nnapiFlags Flags for NNAPI.
+ * @param parallelism Number of threads used to prepare images and decode detections.
+ * `0` uses the number of CPU cores, up to 4.
+ * @param inputFormat Format of the image tensor fed to the model. If the model cannot be
+ * adapted to take the format the detector falls back to [InputFormat.FLOAT_NCHW],
+ * see [modelInputFormat].
  */
 @Suppress("MemberVisibilityCanBePrivate")
 class FaceDetectionRetinaFace
+@JvmOverloads
 @Throws(Exception::class)
-constructor(context: Context, val configuration: SessionConfiguration) : FaceDetection {
+constructor(
+    context: Context,
+    val configuration: SessionConfiguration,
+    val parallelism: Int = 0,
+    val inputFormat: InputFormat = InputFormat.defaultFor(configuration.modelVariant)
+) : FaceDetection {
 
     companion object {
         init {
@@ -44,6 +56,34 @@ constructor(context: Context, val configuration: SessionConfiguration) : FaceDet
         }
         const val MAX_FACES = 100
         const val IMAGE_SIZE = 320
+        private const val GRAYSCALE_FORMAT = 6
+
+        /**
+         * Thread pool shared by the inference sessions of all detectors in the process
+         *
+         * The pool is created with the first detector and released with the last one that is closed.
+         * Changes apply to the pool created next, so set this before creating detectors.
+         */
+        @JvmStatic
+        @Suppress("unused")
+        var threadPoolOptions: ThreadPoolOptions = ThreadPoolOptions()
+            @Synchronized set(value) {
+                setThreadPoolOptions(value.threads, value.allowSpinning)
+                field = value
+            }
+
+        private external fun setThreadPoolOptions(threads: Int, allowSpinning: Boolean)
+
+        /**
+         * Intra-op threads of the environment created last, which [threadPoolOptions] set when it was created
+         */
+        internal external fun environmentThreads(): Int
+
+        /**
+         * `true` if the sessions of the environment created last share its global pool, `false` if
+         * it was created elsewhere in the process without one and each session has its own
+         */
+        internal external fun environmentHasGlobalThreadPools(): Boolean
 
         /**
          * Factory constructor for FaceDetectionRetinaFace
@@ -57,9 +97,18 @@ constructor(context: Context, val configuration: SessionConfiguration) : FaceDet
          * @param forceCalibrate If `true`, the function will always run a calibration pass.
          * Otherwise it will attempt to read previously stored configuration from the device's
          * shared preferences.
+         * @param parallelism Number of threads used to prepare images and decode detections.
+         * `0` uses the number of CPU cores, up to 4.
+         * @param inputFormat Format of the image tensor fed to the model or `null` to choose
+         * the format that suits the calibrated model variant
          * @return Instance of FaceDetectionRetinaFace
          */
-        suspend fun create(context: Context, forceCalibrate: Boolean=false): FaceDetectionRetinaFace {
+        suspend fun create(
+            context: Context,
+            forceCalibrate: Boolean = false,
+            parallelism: Int = 0,
+            inputFormat: InputFormat? = null
+        ): FaceDetectionRetinaFace {
             val modelVariants = mutableMapOf<ModelVariant,String>()
             val appContext = context.applicationContext
             for (variant in ModelVariant.entries) {
@@ -79,7 +128,10 @@ constructor(context: Context, val configuration: SessionConfiguration) : FaceDet
             val configuration = withContext(Dispatchers.Default) {
                 configurationManager.getOptimalSessionConfiguration(forceCalibrate)
             }
-            return FaceDetectionRetinaFace(context, configuration)
+            return FaceDetectionRetinaFace(
+                context, configuration, parallelism,
+                inputFormat ?: InputFormat.defaultFor(configuration.modelVariant)
+            )
         }
 
         /**
@@ -111,12 +163,112 @@ constructor(context: Context, val configuration: SessionConfiguration) : FaceDet
     private val lock = ReentrantLock()
 
     /**
-     * Minimum confidence threshold for detected faces.
+     * Minimum confidence threshold for detected faces, in `[0, 1]`.
+     *
+     * Candidates below the threshold are rejected before they are decoded, so they never take
+     * the place of a face within the detection limit.
      */
     @Suppress("unused")
     var confidenceThreshold: Float = 0.6f
+        set(value) {
+            require(value in 0f..1f) { "Confidence threshold must be in [0, 1]" }
+            lock.withLock {
+                setDetectionFilter(nativeContext, value, minFaceSize, maxFaceSize)
+                field = value
+            }
+        }
+
+    /**
+     * Minimum size of detected faces, the longer side of the face bounds in pixels of the image
+     */
+    @Suppress("unused")
+    var minFaceSize: Float = 0f
+        set(value) {
+            require(value >= 0f && value <= maxFaceSize) { "Minimum face size must be between 0 and the maximum face size" }
+            lock.withLock {
+                setDetectionFilter(nativeContext, confidenceThreshold, value, maxFaceSize)
+                field = value
+            }
+        }
+
+    /**
+     * Maximum size of detected faces, the longer side of the face bounds in pixels of the image
+     */
+    @Suppress("unused")
+    var maxFaceSize: Float = Float.POSITIVE_INFINITY
+        set(value) {
+            require(value >= minFaceSize) { "Maximum face size must not be less than the minimum face size" }
+            lock.withLock {
+                setDetectionFilter(nativeContext, confidenceThreshold, minFaceSize, value)
+                field = value
+            }
+        }
+
+    /**
+     * Name of the image preprocessing kernel selected for the device's CPU,
+     * for example `NEON`, `AVX2` or `Scalar`.
+     */
+    @Suppress("unused")
+    val preprocessingKernel: String
+        get() = preprocessingKernelName()
+
+    /**
+     * Name of the score scanning kernel selected for the device's CPU,
+     * for example `NEON`, `AVX2` or `Scalar`.
+     */
+    @Suppress("unused")
+    val postprocessingKernel: String
+        get() = postprocessingKernelName()
+
+    /**
+     * Format of the image tensor the loaded model takes
+     */
+    @Suppress("unused")
+    val modelInputFormat: InputFormat
+        get() = lock.withLock { InputFormat.fromValue(modelInputFormat(nativeContext)) }
+
+    /**
+     * `true` if the loaded model has dynamic height and width and can run at any [InputSize]
+     */
+    @Suppress("unused")
+    val hasDynamicInputSize: Boolean
+        get() = lock.withLock { hasDynamicInputSize(nativeContext) }
+
+    /**
+     * Non-max suppression that reduces overlapping candidates to one face each
+     */
+    @Suppress("unused")
+    var suppression: SuppressionOptions = SuppressionOptions()
+        set(value) {
+            lock.withLock {
+                setSuppression(nativeContext, value.mode.value, value.iouThreshold, value.sigma)
+                field = value
+            }
+        }
+
+    /**
+     * Heap allocations the last detection made outside the inference session, or `null` unless the
+     * native library was built to count them, as debug builds are with the Gradle property
+     * `faceDetectionCountAllocations=true`
+     */
+    internal val lastDetectionAllocations: Long?
+        get() = lock.withLock { detectionAllocations(nativeContext).takeIf { it >= 0 } }
+
+    /**
+     * Native environment the detector's sessions run on, the same for all detectors in the process
+     */
+    internal val environmentHandle: Long
+        get() = lock.withLock { environmentHandle(nativeContext) }
+
+    /**
+     * Resample plan cache hits and misses of all detections so far. Frames whose region has the same
+     * size, stride, orientation and input size reuse a plan wherever the region is in the image.
+     */
+    internal val planCacheCounts: Pair<Long, Long>
+        get() = lock.withLock { Pair(planCacheHits(nativeContext), planCacheMisses(nativeContext)) }
 
     init {
+        require(parallelism >= 0) { "Parallelism must not be negative" }
         val appContext = context.applicationContext
         val modelFile: File = appContext.filesDir.resolve(configuration.modelVariant.modelName)
         if (!modelFile.exists()) {
@@ -127,7 +279,7 @@ constructor(context: Context, val configuration: SessionConfiguration) : FaceDet
             }
         }
         val modelPath = modelFile.absolutePath
-        nativeContext = createNativeContext(modelPath, configuration.useNnapi, configuration.nnapiOptions.toFlags())
+        nativeContext = createNativeContext(modelPath, configuration.useNnapi, configuration.nnapiOptions.toFlags(), parallelism, inputFormat.value)
     }
 
     /**
@@ -137,12 +289,262 @@ constructor(context: Context, val configuration: SessionConfiguration) : FaceDet
      * @param limit Maximum number of faces to detect. Capped at 100.
      * @return Array of detected [faces][Face].
      */
-    override suspend fun detectFacesInImage(image: IImage, limit: Int): List<Face> {
+    override suspend fun detectFacesInImage(image: IImage, limit: Int): List<Face> =
+        detectFacesInImage(image, limit, Rect(0, 0, image.width, image.height))
+
+    /**
+     * Detect faces in a region of an image
+     *
+     * Only the region is scaled to the detector's input so faces inside a known area (for example
+     * a guide oval or a previously detected face) are detected at a higher resolution than
+     * when scaling the whole image.
+     *
+     * @param image [Image][IImage] in which to detect faces
+     * @param limit Maximum number of faces to detect. Capped at 100.
+     * @param region Region of the image in which to detect faces
+     * @param rotationDegrees Clockwise rotation (0, 90, 180 or 270) that makes the image upright
+     * @param mirrored Set to `true` to flip the upright image horizontally, for example for
+     * front camera images
+     * @param inputSize Size the model runs at
+     * @return Array of detected [faces][Face] in the coordinates of the whole image.
+     */
+    suspend fun detectFacesInImage(
+        image: IImage,
+        limit: Int,
+        region: Rect,
+        rotationDegrees: Int = 0,
+        mirrored: Boolean = false,
+        inputSize: InputSize = InputSize.DEFAULT
+    ): List<Face> {
+        require(limit in 1..MAX_FACES) { "Limit must be between 1 and $MAX_FACES" }
+        requireRegionInBounds(region, image.width, image.height)
+        requireRightAngle(rotationDegrees)
+        return lock.withLock {
+            val numFaces = detectFacesInBuffer(
+                nativeContext, image.toDirectByteBuffer(), image.width, image.height,
+                image.bytesPerRow, image.format.ordinal,
+                region.left, region.top, region.width(), region.height(),
+                rotationDegrees, mirrored, inputSize.width, inputSize.height, inputSize.matchAspectRatio,
+                limit, buffer
+            )
+            facesFromBuffer(numFaces)
+        }
+    }
+
+    /**
+     * Detect faces in several whole images at once
+     *
+     * Up to 8 images run through the model together on the CPU, which takes less time than
+     * running them one by one. A model that cannot be given a dynamic batch size runs the images
+     * one by one.
+     *
+     * @param images [Images][IImage] in which to detect faces
+     * @param limit Maximum number of faces to detect in each image. Capped at 100.
+     * @param rotationDegrees Clockwise rotation (0, 90, 180 or 270) that makes the images upright
+     * @param mirrored Set to `true` to flip the upright images horizontally
+     * @return Detected [faces][Face] of each image, in the order of the images.
+     */
+    suspend fun detectFacesInImages(
+        images: List<IImage>,
+        limit: Int,
+        rotationDegrees: Int = 0,
+        mirrored: Boolean = false
+    ): List<List<Face>> {
+        require(limit in 1..MAX_FACES) { "Limit must be between 1 and $MAX_FACES" }
+        requireRightAngle(rotationDegrees)
+        if (images.isEmpty()) {
+            return emptyList()
+        }
+        val batchBuffer = ByteBuffer.allocateDirect(images.size * limit * 18 * 4)
+            .order(ByteOrder.nativeOrder())
+        val counts = IntArray(images.size)
+        lock.withLock {
+            detectFacesInBuffers(
+                nativeContext, Array(images.size) { images[it].toDirectByteBuffer() },
+                IntArray(images.size) { images[it].width }, IntArray(images.size) { images[it].height },
+                IntArray(images.size) { images[it].bytesPerRow }, IntArray(images.size) { images[it].format.ordinal },
+                rotationDegrees, mirrored, limit, batchBuffer, counts
+            )
+        }
+        return images.indices.map { facesFromBuffer(counts[it], batchBuffer, it * limit) }
+    }
+
+    /**
+     * Detect faces in a large image, such as a group or gallery photo, in overlapping tiles
+     *
+     * Scaling a large image to the detector's input makes small faces too small to detect.
+     * The image is additionally covered with tiles at finer scales, each detected at the full
+     * input resolution, and the faces found in all tiles are merged. Up to 8 tiles run through the
+     * model at once on the CPU, as in [detectFacesInImages].
+     *
+     * @param image [Image][IImage] in which to detect faces
+     * @param limit Maximum number of faces to detect. Capped at 100.
+     * @param tiling Tile scales, overlap and tile budget
+     * @param rotationDegrees Clockwise rotation (0, 90, 180 or 270) that makes the image upright
+     * @param mirrored Set to `true` to flip the upright image horizontally
+     * @return Array of detected [faces][Face] in the coordinates of the image.
+     */
+    suspend fun detectFacesInTiles(
+        image: IImage,
+        limit: Int,
+        tiling: TilingOptions = TilingOptions(),
+        rotationDegrees: Int = 0,
+        mirrored: Boolean = false
+    ): List<Face> {
+        require(limit in 1..MAX_FACES) { "Limit must be between 1 and $MAX_FACES" }
+        requireRightAngle(rotationDegrees)
+        return lock.withLock {
+            val numFaces = detectFacesInTiles(
+                nativeContext, image.toDirectByteBuffer(), image.width, image.height,
+                image.bytesPerRow, image.format.ordinal, rotationDegrees, mirrored,
+                tiling.scales, tiling.overlap, tiling.maxTiles, limit, buffer
+            )
+            facesFromBuffer(numFaces)
+        }
+    }
+
+    /**
+     * Detect faces in a camera frame
+     *
+     * The frame is converted to RGB only at the positions sampled by the detector so there is
+     * no need to convert it to a bitmap first. Rotation and mirroring are applied while sampling
+     * and the detected faces are reported in the coordinates of the unrotated frame.
+     *
+     * @param image Camera image in [YUV_420_888][ImageFormat.YUV_420_888] format
+     * @param limit Maximum number of faces to detect. Capped at 100.
+     * @param grayscale Set to `true` for monochrome or infrared cameras. Only the luma plane
+     * is read and the chroma planes are ignored.
+     * @param region Region of the frame in which to detect faces or `null` to use the whole frame
+     * @param rotationDegrees Clockwise rotation (0, 90, 180 or 270) that makes the frame upright,
+     * as reported by the camera
+     * @param mirrored Set to `true` to flip the upright frame horizontally, for example for
+     * front camera frames
+     * @param inputSize Size the model runs at, for example [InputSize.MATCH_ASPECT_RATIO] to avoid
+     * running the model on padding
+     * @return Array of detected [faces][Face].
+     */
+    suspend fun detectFacesInYuvImage(
+        image: android.media.Image,
+        limit: Int,
+        grayscale: Boolean = false,
+        region: Rect? = null,
+        rotationDegrees: Int = 0,
+        mirrored: Boolean = false,
+        inputSize: InputSize = InputSize.DEFAULT
+    ): List<Face> {
         require(limit in 1..MAX_FACES) { "Limit must be between 1 and $MAX_FACES" }
+        require(image.format == ImageFormat.YUV_420_888) { "Image must be in YUV_420_888 format" }
+        val planes = image.planes
+        if (grayscale) {
+            return detectFacesInGrayscale(
+                planes[0].buffer, image.width, image.height, limit, planes[0].rowStride,
+                region, rotationDegrees, mirrored, inputSize
+            )
+        }
+        require(planes[1].rowStride == planes[2].rowStride && planes[1].pixelStride == planes[2].pixelStride) {
+            "U and V planes must have the same layout"
+        }
+        val roi = region ?: Rect(0, 0, image.width, image.height)
+        requireRegionInBounds(roi, image.width, image.height)
+        requireRightAngle(rotationDegrees)
         return lock.withLock {
-            val scale = minOf(1.0f, IMAGE_SIZE.toFloat() / max(image.width, image.height).toFloat())
-            val numFaces = detectFacesInBuffer(nativeContext, image.toDirectByteBuffer(), image.width, image.height, image.bytesPerRow, image.format.ordinal, limit, buffer)
-            facesFromBuffer(numFaces, 1f / scale)
+            val numFaces = detectFacesInYuvBuffers(
+                nativeContext,
+                planes[0].buffer, planes[1].buffer, planes[2].buffer,
+                image.width, image.height,
+                planes[0].rowStride, planes[1].rowStride, planes[1].pixelStride,
+                roi.left, roi.top, roi.width(), roi.height(),
+                rotationDegrees, mirrored, inputSize.width, inputSize.height, inputSize.matchAspectRatio,
+                limit, buffer
+            )
+            facesFromBuffer(numFaces)
+        }
+    }
+
+    /**
+     * Detect faces in a grayscale frame, such as the luma plane of a monochrome or infrared camera
+     *
+     * Each sample is read once and fed to the model in all three colour channels.
+     *
+     * @param data Direct byte buffer with one byte per pixel
+     * @param width Frame width
+     * @param height Frame height
+     * @param limit Maximum number of faces to detect. Capped at 100.
+     * @param bytesPerRow Distance between the starts of consecutive rows
+     * @param region Region of the frame in which to detect faces or `null` to use the whole frame
+     * @param rotationDegrees Clockwise rotation (0, 90, 180 or 270) that makes the frame upright
+     * @param mirrored Set to `true` to flip the upright frame horizontally
+     * @param inputSize Size the model runs at
+     * @return Array of detected [faces][Face] in the coordinates of the unrotated frame.
+     */
+    suspend fun detectFacesInGrayscale(
+        data: ByteBuffer,
+        width: Int,
+        height: Int,
+        limit: Int,
+        bytesPerRow: Int = width,
+        region: Rect? = null,
+        rotationDegrees: Int = 0,
+        mirrored: Boolean = false,
+        inputSize: InputSize = InputSize.DEFAULT
+    ): List<Face> {
+        require(limit in 1..MAX_FACES) { "Limit must be between 1 and $MAX_FACES" }
+        require(data.isDirect) { "Grayscale buffer must be a direct buffer" }
+        require(bytesPerRow >= width && data.capacity() >= bytesPerRow * (height - 1) + width) { "Grayscale buffer too small" }
+        val roi = region ?: Rect(0, 0, width, height)
+        requireRegionInBounds(roi, width, height)
+        requireRightAngle(rotationDegrees)
+        return lock.withLock {
+            val numFaces = detectFacesInBuffer(
+                nativeContext, data, width, height, bytesPerRow, GRAYSCALE_FORMAT,
+                roi.left, roi.top, roi.width(), roi.height(),
+                rotationDegrees, mirrored, inputSize.width, inputSize.height, inputSize.matchAspectRatio,
+                limit, buffer
+            )
+            facesFromBuffer(numFaces)
+        }
+    }
+
+    /**
+     * Detect faces in an NV21 camera frame
+     *
+     * @param data Direct byte buffer with the NV21 frame (Y plane followed by interleaved V/U plane)
+     * @param width Frame width
+     * @param height Frame height
+     * @param limit Maximum number of faces to detect. Capped at 100.
+     * @param region Region of the frame in which to detect faces or `null` to use the whole frame
+     * @param rotationDegrees Clockwise rotation (0, 90, 180 or 270) that makes the frame upright
+     * @param mirrored Set to `true` to flip the upright frame horizontally
+     * @param inputSize Size the model runs at
+     * @return Array of detected [faces][Face] in the coordinates of the unrotated frame.
+     */
+    suspend fun detectFacesInNv21(
+        data: ByteBuffer,
+        width: Int,
+        height: Int,
+        limit: Int,
+        region: Rect? = null,
+        rotationDegrees: Int = 0,
+        mirrored: Boolean = false,
+        inputSize: InputSize = InputSize.DEFAULT
+    ): List<Face> {
+        require(limit in 1..MAX_FACES) { "Limit must be between 1 and $MAX_FACES" }
+        require(data.isDirect) { "NV21 buffer must be a direct buffer" }
+        require(data.capacity() >= width * height * 3 / 2) { "NV21 buffer too small" }
+        val roi = region ?: Rect(0, 0, width, height)
+        requireRegionInBounds(roi, width, height)
+        requireRightAngle(rotationDegrees)
+        val chromaStart = width * height
+        val v = data.duplicate().apply { position(chromaStart) }.slice()
+        val u = data.duplicate().apply { position(chromaStart + 1) }.slice()
+        return lock.withLock {
+            val numFaces = detectFacesInYuvBuffers(
+                nativeContext, data, u, v, width, height, width, width, 2,
+                roi.left, roi.top, roi.width(), roi.height(),
+                rotationDegrees, mirrored, inputSize.width, inputSize.height, inputSize.matchAspectRatio,
+                limit, buffer
+            )
+            facesFromBuffer(numFaces)
         }
     }
 
@@ -159,31 +561,40 @@ constructor(context: Context, val configuration: SessionConfiguration) : FaceDet
         }
     }
 
-    private fun facesFromBuffer(count: Int, scale: Float): List<Face> {
+    private fun requireRegionInBounds(region: Rect, width: Int, height: Int) {
+        require(!region.isEmpty && region.left >= 0 && region.top >= 0 && region.right <= width && region.bottom <= height) {
+            "Region must be a non-empty rectangle inside the image"
+        }
+    }
+
+    private fun requireRightAngle(rotationDegrees: Int) {
+        require(rotationDegrees in setOf(0, 90, 180, 270)) { "Rotation must be 0, 90, 180 or 270 degrees" }
+    }
+
+    private fun facesFromBuffer(count: Int, buffer: ByteBuffer = this.buffer, first: Int = 0): List<Face> {
         buffer.rewind()
         val floatBuffer = buffer.asFloatBuffer()
         val faces = mutableListOf<Face>()
         for (i in 0..<count) {
-            val index = i * 18
-            val x = floatBuffer[index] * scale
-            val y = floatBuffer[index+1] * scale
-            val width = floatBuffer[index+2] * scale
-            val height = floatBuffer[index+3] * scale
+            val index = (first + i) * 18
+            val x = floatBuffer[index]
+            val y = floatBuffer[index+1]
+            val width = floatBuffer[index+2]
+            val height = floatBuffer[index+3]
             val yaw = floatBuffer[index+4]
             val pitch = floatBuffer[index+5]
             val roll = floatBuffer[index+6]
-            val leftEyeX = floatBuffer[index+7] * scale
-            val leftEyeY = floatBuffer[index+8] * scale
-            val rightEyeX = floatBuffer[index+9] * scale
-            val rightEyeY = floatBuffer[index+10] * scale
-            val noseX = floatBuffer[index+11] * scale
-            val noseY = floatBuffer[index+12] * scale
-            val leftMouthX = floatBuffer[index+13] * scale
-            val leftMouthY = floatBuffer[index+14] * scale
-            val rightMouthX = floatBuffer[index+15] * scale
-            val rightMouthY = floatBuffer[index+16] * scale
+            val leftEyeX = floatBuffer[index+7]
+            val leftEyeY = floatBuffer[index+8]
+            val rightEyeX = floatBuffer[index+9]
+            val rightEyeY = floatBuffer[index+10]
+            val noseX = floatBuffer[index+11]
+            val noseY = floatBuffer[index+12]
+            val leftMouthX = floatBuffer[index+13]
+            val leftMouthY = floatBuffer[index+14]
+            val rightMouthX = floatBuffer[index+15]
+            val rightMouthY = floatBuffer[index+16]
             val confidence = floatBuffer[index+17]
-            if (confidence < confidenceThreshold) continue
             faces.add(Face(
                 bounds = RectF(x, y, x+width, y+height),
                 angle = EulerAngle(yaw, pitch, roll),
@@ -205,11 +616,47 @@ constructor(context: Context, val configuration: SessionConfiguration) : FaceDet
         return faces
     }
 
-    private external fun createNativeContext(modelPath: String, useNnapi: Boolean, nnapiFlags: Int): Long
+    private external fun createNativeContext(modelPath: String, useNnapi: Boolean, nnapiFlags: Int, parallelism: Int, inputFormat: Int): Long
 
     private external fun destroyNativeContext(context: Long)
 
-    private external fun detectFacesInBuffer(context: Long, imageBuffer: ByteBuffer, width:Int, height: Int, bytesPerRow:Int, imageFormat:Int, limit: Int, buffer: ByteBuffer): Int
+    private external fun detectFacesInBuffer(context: Long, imageBuffer: ByteBuffer, width:Int, height: Int, bytesPerRow:Int, imageFormat:Int, regionX: Int, regionY: Int, regionWidth: Int, regionHeight: Int, rotation: Int, mirrored: Boolean, inputWidth: Int, inputHeight: Int, matchAspectRatio: Boolean, limit: Int, buffer: ByteBuffer): Int
+
+    private external fun detectFacesInBuffers(context: Long, imageBuffers: Array<ByteBuffer>, widths: IntArray, heights: IntArray, bytesPerRow: IntArray, imageFormats: IntArray, rotation: Int, mirrored: Boolean, limit: Int, buffer: ByteBuffer, counts: IntArray)
+
+    private external fun detectFacesInTiles(context: Long, imageBuffer: ByteBuffer, width: Int, height: Int, bytesPerRow: Int, imageFormat: Int, rotation: Int, mirrored: Boolean, scales: Int, overlap: Float, maxTiles: Int, limit: Int, buffer: ByteBuffer): Int
+
+    private external fun modelInputFormat(context: Long): Int
+
+    private external fun hasDynamicInputSize(context: Long): Boolean
+
+    private external fun detectionAllocations(context: Long): Long
+
+    private external fun environmentHandle(context: Long): Long
+
+    private external fun planCacheHits(context: Long): Long
+
+    private external fun planCacheMisses(context: Long): Long
+
+    private external fun setDetectionFilter(context: Long, scoreThreshold: Float, minFaceSize: Float, maxFaceSize: Float)
+
+    private external fun setSuppression(context: Long, mode: Int, iouThreshold: Float, sigma: Float)
+
+    private external fun preprocessingKernelName(): String
+
+    internal external fun verifyPreprocessingKernels(): Boolean
+
+    private external fun postprocessingKernelName(): String
+
+    internal external fun verifyPostprocessingKernels(): Boolean
+
+    internal external fun verifyPriorTables(): Boolean
+
+    internal external fun verifyNonMaxSuppression(): Boolean
+
+    internal external fun benchmarkNonMaxSuppression(candidateCount: Int, mode: Int, iterations: Int): Double
+
+    private external fun detectFacesInYuvBuffers(context: Long, yBuffer: ByteBuffer, uBuffer: ByteBuffer, vBuffer: ByteBuffer, width: Int, height: Int, yRowStride: Int, uvRowStride: Int, uvPixelStride: Int, regionX: Int, regionY: Int, regionWidth: Int, regionHeight: Int, rotation: Int, mirrored: Boolean, inputWidth: Int, inputHeight: Int, matchAspectRatio: Boolean, limit: Int, buffer: ByteBuffer): Int
 }
 
 private fun IImage.toDirectByteBuffer(): ByteBuffer {
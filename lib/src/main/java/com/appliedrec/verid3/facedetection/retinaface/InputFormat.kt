@@ -0,0 +1,50 @@
+package com.appliedrec.verid3.facedetection.retinaface
+
+/**
+ * Format of the image tensor the detector feeds to the model
+ *
+ * @property value Value passed to the native detector
+ */
+enum class InputFormat(val value: Int) {
+    /**
+     * Mean-subtracted 32-bit floating point planes, converted on the CPU
+     */
+    FLOAT_NCHW(0),
+
+    /**
+     * Interleaved 8-bit RGB. The conversion to float and the mean subtraction are added to the
+     * model graph when the model is loaded so they run in the inference engine's kernels.
+     */
+    UINT8_NHWC(1),
+
+    /**
+     * Mean-subtracted 16-bit floating point planes for the [ModelVariant.FP16] model, whose
+     * inputs and outputs are changed to half precision when the model is loaded
+     */
+    FLOAT16_NCHW(2),
+
+    /**
+     * Mean-subtracted planes quantized with the input scale and zero point of the
+     * [ModelVariant.INT8] model, which then skips quantizing its input
+     */
+    QUANTIZED_NCHW(3);
+
+    companion object {
+        @JvmStatic
+        fun fromValue(value: Int): InputFormat = entries.first { it.value == value }
+
+        /**
+         * Input format that suits the model variant best
+         *
+         * @param modelVariant Model variant
+         * @return [FLOAT16_NCHW] for the [ModelVariant.FP16] variant, [QUANTIZED_NCHW] for the
+         * [ModelVariant.INT8] variant, otherwise [FLOAT_NCHW]
+         */
+        @JvmStatic
+        fun defaultFor(modelVariant: ModelVariant): InputFormat = when (modelVariant) {
+            ModelVariant.FP16 -> FLOAT16_NCHW
+            ModelVariant.INT8 -> QUANTIZED_NCHW
+            ModelVariant.FP32 -> FLOAT_NCHW
+        }
+    }
+}
@@ -0,0 +1,39 @@
+package com.appliedrec.verid3.facedetection.retinaface
+
+/**
+ * Size of the image tensor the model runs at
+ *
+ * Inference time grows with the number of input pixels, so running a model exported with dynamic
+ * height and width at the aspect ratio of the image, for example 320 × 192 for a 16:9 camera
+ * frame, avoids spending it on padding. Models with a fixed input size always run at that size,
+ * see [FaceDetectionRetinaFace.hasDynamicInputSize].
+ *
+ * @property width Input width, a multiple of 32, or `0` for the model's default size
+ * @property height Input height, a multiple of 32, or `0` for the model's default size
+ * @property matchAspectRatio Set to `true` to keep the longer side (the default size when
+ * [width] and [height] are `0`) and fit the shorter side to the aspect ratio of the upright image
+ */
+data class InputSize(
+    val width: Int = 0,
+    val height: Int = 0,
+    val matchAspectRatio: Boolean = false
+) {
+    init {
+        require(width >= 0 && height >= 0) { "Input size must not be negative" }
+        require(width % 32 == 0 && height % 32 == 0) { "Input size must be a multiple of 32" }
+    }
+
+    companion object {
+        /**
+         * The model's default input size, 320 × 320 for the bundled models
+         */
+        @JvmField
+        val DEFAULT = InputSize()
+
+        /**
+         * The default input size with the shorter side fitted to the image
+         */
+        @JvmField
+        val MATCH_ASPECT_RATIO = InputSize(matchAspectRatio = true)
+    }
+}
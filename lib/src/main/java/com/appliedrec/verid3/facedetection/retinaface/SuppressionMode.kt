@@ -0,0 +1,45 @@
+package com.appliedrec.verid3.facedetection.retinaface
+
+/**
+ * How overlapping detections of the same face are reduced to one
+ *
+ * @property value Value passed to the native detector
+ */
+enum class SuppressionMode(val value: Int) {
+    /**
+     * Greedy non-max suppression dropping every box that overlaps a better one by the IoU
+     * threshold or more
+     */
+    HARD(0),
+
+    /**
+     * Soft-NMS scaling the score of every box that overlaps a better one by the IoU threshold or
+     * more by `1 - IoU`. Boxes whose score decays below the confidence threshold are dropped.
+     */
+    SOFT_LINEAR(1),
+
+    /**
+     * Soft-NMS scaling the score of every overlapping box by `exp(-IoU² / sigma)`. Boxes whose
+     * score decays below the confidence threshold are dropped.
+     */
+    SOFT_GAUSSIAN(2),
+
+    /**
+     * Box voting: each face is the score-weighted average of the boxes, landmarks and angles
+     * overlapping the best box by the IoU threshold or more
+     */
+    WEIGHTED(3),
+
+    /**
+     * Peak extraction: only candidates whose score is the maximum of their 3×3 neighbourhood on
+     * the model's anchor grid are decoded, and the peaks of different feature maps are merged as
+     * in [HARD]. Its cost depends on the model's input size rather than on the number of
+     * candidates, which bounds the post-processing time of crowded frames.
+     */
+    PEAKS(4);
+
+    companion object {
+        @JvmStatic
+        fun fromValue(value: Int): SuppressionMode = entries.first { it.value == value }
+    }
+}
@@ -0,0 +1,24 @@
+package com.appliedrec.verid3.facedetection.retinaface
+
+/**
+ * Non-max suppression of the detector's candidate boxes
+ *
+ * @property mode Suppression mode
+ * @property iouThreshold Intersection over union at which boxes count as the same face, in `[0, 1]`.
+ * Not used by [SuppressionMode.SOFT_GAUSSIAN].
+ * @property sigma Width of the [SuppressionMode.SOFT_GAUSSIAN] decay; smaller values suppress harder
+ *
+ * The soft modes drop a box once its score decays below the detector's
+ * [confidence threshold][FaceDetectionRetinaFace.confidenceThreshold], so every face they return
+ * meets the threshold with its decayed score.
+ */
+data class SuppressionOptions(
+    val mode: SuppressionMode = SuppressionMode.HARD,
+    val iouThreshold: Float = 0.4f,
+    val sigma: Float = 0.5f
+) {
+    init {
+        require(iouThreshold in 0f..1f) { "IoU threshold must be in [0, 1]" }
+        require(sigma > 0f) { "Sigma must be positive" }
+    }
+}
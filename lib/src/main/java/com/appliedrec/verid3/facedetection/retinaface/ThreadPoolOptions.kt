@@ -0,0 +1,18 @@
+package com.appliedrec.verid3.facedetection.retinaface
+
+/**
+ * Thread pool that the inference of every detector in the process runs on
+ *
+ * @property threads Number of threads, the calling thread included. `0` uses the number of CPU
+ * cores, up to 4.
+ * @property allowSpinning If `true`, idle threads spin briefly before sleeping. This lowers the
+ * latency of back-to-back detections at the cost of CPU time.
+ */
+data class ThreadPoolOptions(
+    val threads: Int = 0,
+    val allowSpinning: Boolean = true
+) {
+    init {
+        require(threads in 0..64) { "Threads must be between 0 and 64" }
+    }
+}
@@ -0,0 +1,24 @@
+package com.appliedrec.verid3.facedetection.retinaface
+
+/**
+ * Tiling of large images for [FaceDetectionRetinaFace.detectFacesInTiles]
+ *
+ * More scales and tiles find smaller faces at the cost of one inference per tile.
+ *
+ * @property scales Number of tile scales. The first scale is the whole image and each following
+ * scale halves the tile size, down to [FaceDetectionRetinaFace.IMAGE_SIZE] pixels.
+ * @property overlap Fraction of a tile shared with its neighbours, in `[0, 1)`. Faces smaller
+ * than the overlap always lie entirely inside some tile of their scale.
+ * @property maxTiles Maximum number of tiles. Scales that would exceed it are left out.
+ */
+data class TilingOptions(
+    val scales: Int = 2,
+    val overlap: Float = 0.25f,
+    val maxTiles: Int = 16
+) {
+    init {
+        require(scales >= 1) { "At least one scale is required" }
+        require(overlap >= 0f && overlap < 1f) { "Overlap must be in [0, 1)" }
+        require(maxTiles >= 1) { "At least one tile is required" }
+    }
+}